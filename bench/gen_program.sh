@@ -0,0 +1,20 @@
+#! /bin/bash
+# Writes a lispy program of about SIZE megabytes to stdout, the same every run:
+# definitions of nested lists of numbers, decimals, strings and symbols,
+# function definitions and comments.
+#
+# usage: bench/gen_program.sh [SIZE], the default is 10
+
+awk -v size="${1:-10}" 'BEGIN {
+    limit = size * 1024 * 1024
+    for (i = 0; bytes < limit; i++) {
+        if (i % 5 == 4) {
+            line = sprintf("(fun {f%d x y} {+ x (* y %d) (- %d x)}) ; function %d", i, i % 97, i % 13, i)
+        } else {
+            line = sprintf("(def {v%d} {%d -%d %d.%d \"str %d\" sym%d (+ %d %d) {%d {%d %d}}})",
+                i, i, i % 1000, i % 7, i % 100, i, i % 50, i % 9, i % 11, i % 3, i % 5, i % 8)
+        }
+        print line
+        bytes += length(line) + 1
+    }
+}'
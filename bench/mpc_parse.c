@@ -0,0 +1,66 @@
+/* parses a program with the interpreter's mpc grammar from a string input,
+ * the way the REPL and the -DMPC_READER build do, and prints the seconds it
+ * took. used by bench/mpc_parse.sh.
+ *
+ * usage: mpc_parse FILE
+*/
+#include "../mpc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s FILE\n", argv[0]);
+        return 2;
+    }
+    FILE* f = fopen(argv[1], "rb");
+    if (!f) {
+        perror(argv[1]);
+        return 2;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* src = malloc(len + 1);
+    src[fread(src, 1, len, f)] = '\0';
+    fclose(f);
+
+    // the grammar of main in hyperlambda.c
+    mpc_parser_t* Number = mpc_new("number");
+    mpc_parser_t* String = mpc_new("string");
+    mpc_parser_t* Symbol = mpc_new("symbol");
+    mpc_parser_t* Comment = mpc_new("comment");
+    mpc_parser_t* Sexpr = mpc_new("sexpr");
+    mpc_parser_t* Qexpr = mpc_new("qexpr");
+    mpc_parser_t* Expr = mpc_new("expr");
+    mpc_parser_t* Program = mpc_new("program");
+
+    mpca_lang(MPCA_LANG_DEFAULT,
+    "                                                                                               \
+        number  : /-?[0-9]+(\\.[0-9]+)?/ ;                                                         \
+        symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&?]+/ ;                                               \
+        string  : /\"(\\\\.|[^\"])*\"/ ;                                                            \
+        comment : /;[^\\r\\n]*/ ;                                                                   \
+        sexpr   : '(' <expr>* ')' ;                                                                 \
+        qexpr   : '{' <expr>* '}' ;                                                                 \
+        expr    : <number> | <string> | <symbol> | <comment> | <sexpr> | <qexpr>;                   \
+        program : /^/ <expr>* /$/ ;                                                                 \
+    ", Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Program);
+
+    clock_t start = clock();
+    mpc_result_t result;
+    int ok = mpc_parse(argv[1], src, Program, &result);
+    double secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    if (!ok) {
+        mpc_err_print(result.error);
+        mpc_err_delete(result.error);
+        return 1;
+    }
+    mpc_ast_delete(result.output);
+    mpc_cleanup(8, Number, String, Symbol, Comment, Sexpr, Qexpr, Expr, Program);
+    free(src);
+    printf("%.2f\n", secs);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#! /bin/bash
+# Regression benchmark for parsing with mpc from a string input. It times a
+# generated program of 1 MB and one of SIZE MB (10 by default). It fails if the
+# large one takes more than RATIO (3 by default) times as long per megabyte
+# as the small one. Parsing is linear, so the ratio stays near 1. A
+# quadratic end-of-input check, which rescans the whole input per character,
+# takes it to around SIZE.
+#
+# usage: bench/mpc_parse.sh [SIZE] [RATIO], run from anywhere
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+size=${1:-10}
+ratio=${2:-3}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+gcc -O2 "$root/bench/mpc_parse.c" "$root/mpc.c" -lm -o "$dir/mpc_parse" || exit 1
+"$root/bench/gen_program.sh" 1 > "$dir/small.lspy"
+"$root/bench/gen_program.sh" "$size" > "$dir/large.lspy"
+
+small=$("$dir/mpc_parse" "$dir/small.lspy") || exit 1
+large=$("$dir/mpc_parse" "$dir/large.lspy") || exit 1
+echo "1 MB: ${small}s, $size MB: ${large}s"
+
+awk -v s="$small" -v l="$large" -v n="$size" -v r="$ratio" 'BEGIN {
+    if (s < 0.01) { s = 0.01 } # too quick to measure
+    per = l / n / s
+    printf "per megabyte the large program took %.1fx as long\n", per
+    if (per > r) { print "parsing is no longer linear in the input size"; exit 1 }
+}'
@@ -1,2 +1,2 @@
 #! /bin/bash
-gcc hyperlambda.c mpc.c -ledit -lm -o hyperlambda
\ No newline at end of file
+gcc hyperlambda.c mpc.c -ledit -lm -lpthread -o hyperlambda
\ No newline at end of file
@@ -3,9 +3,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <time.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+
+#if defined(_WIN32) && !defined(NO_THREADS)
+#define NO_THREADS
+#endif
+
+#ifndef NO_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
 
 #ifdef _WIN32
 #include <string.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
 
 static const short BUF_SIZE = 2048;
 static char buffer[BUF_SIZE];
@@ -40,12 +61,18 @@ struct lenv;
 typedef struct lval lval;
 typedef struct lenv lenv; // basically so you don't need to type out struct lenv every time
 // possible lval types
-enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUNC, LVAL_STR };
+enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUNC, LVAL_STR, LVAL_FLOAT, LVAL_BIG, LVAL_VEC, LVAL_VNODE, LVAL_MAP, LVAL_MNODE };
 
 char* ltype_name(int t) {
     switch(t) {
         case LVAL_FUNC:     return "Function";
         case LVAL_NUM:      return "Number";
+        case LVAL_FLOAT:    return "Float";
+        case LVAL_BIG:      return "Big Number";
+        case LVAL_VEC:      return "Vector";
+        case LVAL_VNODE:    return "Vector Node";
+        case LVAL_MAP:      return "Map";
+        case LVAL_MNODE:    return "Map Node";
         case LVAL_ERR:      return "Error";
         case LVAL_STR:      return "String";
         case LVAL_SYM:      return "Symbol";
@@ -59,141 +86,891 @@ typedef lval*(*lbuiltin)(lenv*, lval*);
 
 // forward declaration TODO: move to header file
 lval* lval_eval(lenv* env, lval* value);
-lval* lval_copy(lval* value);
-void lval_del(lval* v);
+lval* lval_eval_sexpr(lenv* env, lval* v);
 lval* lval_err(char* fmt, ...);
 lval* lval_pop(lval* v, int i);
 lval* builtin_eval(lenv* env, lval* args);
 lval* builtin_list(lenv* env, lval* a);
 lval* builtin_load(lenv* env, lval* ast);
+double big_double(lval* v);
+int lval_eq(lval* x, lval* y);
+void cons_remove(lval* v);
 
 /* lval is a lisp value type, it can be a number, error or operator/symbol.
  * it holds a count to how many pointers are in the array cell, cell is an
  * array of pointers to lisp values. basically a linked list structure but
  * implemented as a dynamic array.
+ *
+ * cell points off into a buffer of cap slots: popping the front just moves cell
+ * forward and appending doubles the buffer when it is full, so both are O(1)
+ * amortized. a list can also be a view into another list's buffer (cap is 0
+ * and owner keeps the buffer alive), which is how tail avoids copying.
+ *
+ * lvals are owned by the garbage collector and freely shared between lists and
+ * environments, so a value must never be modified once something else can see
+ * it. builtins build new values instead, only the argument list they are
+ * handed is theirs to take apart.
+ *
+ * only the fields of the value's own type are stored, they share a union. small
+ * integers (fixnums) are not stored at all: the number is shifted left and kept
+ * in the lval* itself with the low bit set, heap lvals are always aligned so
+ * their low bit is clear. so always go through lval_type and lval_long rather
+ * than v->type and v->num, v may not point anywhere.
 */
 struct lval {
     int type;
+    char mark; // reached during the current collection
+    char compiled; // has bytecode in the code table
+    char hashed; // lists only, hash holds the list's lval_hash
+    char consed; // in the hash consing table
+    lval* gc_next; // next lval on the heap
 
-    long num;
-    char* err;
-    char* sym;
-    char* str;
-    
-    lbuiltin builtin; // if null then it is user defined function
-    lenv* env;
-    lval* params;
-    lval* body;
+    union {
+        long num; // only numbers too big for a fixnum
+        double dbl; // floats are always on the heap
 
-    int count;
-    lval** cell;
+        struct { // integers too big for a long
+            int neg;
+            int len; // limbs in use
+            uint32_t* limbs;
+        };
+
+        struct { // persistent vectors
+            lval* vroot;
+            long vcount;
+            int vshift; // bits of the index below the root's digit
+        };
+
+        struct { // hash maps
+            lval* mroot; // NULL when empty
+            long mcount;
+        };
+        char* err;
+        char* sym; // interned, compare by pointer
+        char* str;
+
+        struct {
+            lbuiltin builtin; // if null then it is user defined function
+            lenv* env;
+            lval* params;
+            lval* body;
+        };
+
+        struct {
+            int count;
+            int off; // slots in front of cell that were popped
+            int cap; // slots in the buffer, 0 if the buffer belongs to owner
+            union {
+                uint32_t hash; // lists
+                uint32_t bitmap; // map nodes, which hash digits have an entry
+            };
+            lval** cell;
+            lval* owner; // list whose buffer cell points into, NULL if it is ours
+        };
+    };
 };
 
-/* environment struct holds name/symbol value associations */
-struct lenv {
-    lenv* parenv; // parent environment
+#define FIXNUM_MIN (LONG_MIN >> 1)
+#define FIXNUM_MAX (LONG_MAX >> 1)
+
+static inline int lval_is_fixnum(lval* v) { return ((uintptr_t) v) & 1; }
+
+static inline int lval_type(lval* v) {
+    return lval_is_fixnum(v) ? LVAL_NUM : v->type;
+}
+
+static inline long lval_long(lval* v) {
+    return lval_is_fixnum(v) ? (long) ((intptr_t) v >> 1) : v->num;
+}
+
+/* integers, bignums and floats mix in arithmetic and comparisons, as soon as
+ * one float is involved the whole operation is done in doubles */
+static inline int lval_is_number(lval* v) {
+    return lval_is_fixnum(v) || v->type == LVAL_NUM || v->type == LVAL_FLOAT || v->type == LVAL_BIG;
+}
+
+static inline double lval_double(lval* v) {
+    switch (lval_type(v)) {
+        case LVAL_FLOAT: return v->dbl;
+        case LVAL_BIG: return big_double(v);
+        default: return (double) lval_long(v);
+    }
+}
+
+/* Threads
+ * pmap, pfilter and preduce run lisp code on worker threads, see Parallel
+ * functions. every thread has its own heap, allocator, bytecode machine and
+ * code table, and the main thread waits while the workers run. what they
+ * share is everything the main thread had made, which nothing changes while
+ * they run, and the symbol table, which is locked while they run (the flags of
+ * a symbol are atomic instead). build with
+ * -DNO_THREADS to run the parallel functions one element at a time instead.
+*/
+#ifdef NO_THREADS
+#define THREAD_LOCAL
+#define PAR_LOCK(lock)
+#define PAR_UNLOCK(lock)
+#define PAR_SHARED(x) 0
+static const int par_worker = 0;
+#else
+#define THREAD_LOCAL _Thread_local
+static int par_running; // set by the main thread while workers run
+static THREAD_LOCAL int par_worker; // this is a worker thread
+
+/* true in a worker for an lval or lenv of the main thread, which it must not
+ * change. the main thread leaves everything it can reach marked while the
+ * workers run, and a worker's own objects are only marked in its collections */
+#define PAR_SHARED(x) (par_worker && (x)->mark)
+#define PAR_LOCK(lock) if (par_running) { pthread_mutex_lock(&lock); }
+#define PAR_UNLOCK(lock) if (par_running) { pthread_mutex_unlock(&lock); }
+static pthread_mutex_t sym_lock = PTHREAD_MUTEX_INITIALIZER; // the table of interned names
+#ifdef MPC_READER
+static pthread_mutex_t mpc_lock = PTHREAD_MUTEX_INITIALIZER; // the parsers of the grammar
+#endif
+#endif
+
+/* symbol interning: every symbol name is stored exactly once in a process wide
+ * table, so two symbols with the same name share the same char*. This lets the
+ * environment hash and compare symbols by pointer instead of by strcmp.
+ * names are never freed, the set of symbols a program uses is small. the byte
+ * in front of each name holds flags about the symbol.
+*/
+typedef struct {
     int count;
-    char** symbols;
+    int cap; // always a power of two
+    char** names; // NULL marks an empty slot
+} symtab;
+
+static symtab interned = { 0, 0, NULL };
+
+#define SYM_LOCAL 1 // bound somewhere other than the global environment
+
+/* a symbol that was never bound outside the global environment can only be
+ * global. workers set the flag too, when a lambda they run binds a formal, so
+ * it is read and set atomically. it is only ever set, and a thread always sees
+ * what it set itself, so relaxed order is enough */
+static inline int sym_is_local(char* sym) {
+    return __atomic_load_n(&sym[-1], __ATOMIC_RELAXED) & SYM_LOCAL;
+}
+static inline void sym_mark_local(char* sym) {
+    if (sym_is_local(sym)) { return; }
+    __atomic_fetch_or(&sym[-1], SYM_LOCAL, __ATOMIC_RELAXED);
+}
+
+// symbols the interpreter itself compares against
+char* sym_amp;
+
+// FNV-1a, good enough for short identifiers
+unsigned long str_hash(char* s, size_t len) {
+    unsigned long h = 2166136261u;
+    while (len--) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void symtab_insert(symtab* t, char* name, unsigned long hash) {
+    unsigned long i = hash & (t->cap - 1);
+    while (t->names[i]) { i = (i + 1) & (t->cap - 1); } // linear probing
+    t->names[i] = name;
+    t->count++;
+}
+
+static char* symtab_intern(char* name, size_t len) {
+    unsigned long hash = str_hash(name, len);
+    if (interned.cap) {
+        unsigned long i = hash & (interned.cap - 1);
+        while (interned.names[i]) {
+            char* n = interned.names[i];
+            if (strncmp(n, name, len) == 0 && n[len] == '\0') { return n; }
+            i = (i + 1) & (interned.cap - 1);
+        }
+    }
+    // keep the load factor under 1/2 so probe sequences stay short
+    if ((interned.count + 1) * 2 > interned.cap) {
+        symtab grown = { 0, interned.cap ? interned.cap * 2 : 256, NULL };
+        grown.names = calloc(grown.cap, sizeof(char*));
+        for (int i = 0; i < interned.cap; i++) {
+            if (interned.names[i]) {
+                char* n = interned.names[i];
+                symtab_insert(&grown, n, str_hash(n, strlen(n)));
+            }
+        }
+        free(interned.names);
+        interned = grown;
+    }
+    char* copy = malloc(len + 2) + 1; // room for the flags
+    copy[-1] = 0;
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    symtab_insert(&interned, copy, hash);
+    return copy;
+}
+
+// returns the unique copy of the len bytes at name, adding it to the table if it is new
+char* sym_intern_len(char* name, size_t len) {
+    PAR_LOCK(sym_lock);
+    char* sym = symtab_intern(name, len);
+    PAR_UNLOCK(sym_lock);
+    return sym;
+}
+
+char* sym_intern(char* name) { return sym_intern_len(name, strlen(name)); }
+
+/* environment struct holds name/symbol value associations. the bindings live in
+ * an open addressing hash table keyed on interned symbol names, so a lookup is
+ * a pointer hash and a few pointer compares no matter how many functions the
+ * prelude and user scripts have defined.
+ *
+ * a call frame keeps the arguments of the call in a flat array instead, slot i
+ * holding formal i, so compiled code reads a parameter with an indexed load.
+ * the table then only holds what the body binds with '='.
+ *
+ * a lambda closes over the frame it was made in and a call frame links to it
+ * through outer, frames are shared and never copied. scoping is lexical: a
+ * symbol is looked up in the frame, then in the frames it closes over, then in
+ * the global environment. the caller's variables are never seen.
+*/
+struct lenv {
+    lenv* outer; // frame the function was defined in, NULL at top level
+    int count; // number of bindings in the table
+    int cap; // number of slots, zero or a power of two
+    char** symbols; // interned names, NULL marks an empty slot
     lval** values;
+    lval* names; // formals of a call frame, or NULL
+    lval** slots; // the value of each formal
+    int arity; // number of slots
+
+    int mark;
+    lenv* gc_next; // next lenv on the heap
 };
 
+/* Slab allocator
+ * lvals, environments and small arrays come out of 64k slabs and are recycled
+ * through a free list per size class, so the interpreter rarely has to call
+ * malloc or free. slabs are only handed back on exit. build with -DNO_POOL to use plain malloc, e.g. for ASan runs.
+ * the pool also counts the bytes it has handed out, which is the size of the heap.
+*/
+#define POOL_SLAB_SIZE (64 * 1024)
+
+static const int pool_sizes[] = { 8, 16, 32, 48, 64, 80, 128, 256 }; // sizeof(lval) is 48, sizeof(lenv) 72
+#define POOL_CLASSES ((int) (sizeof(pool_sizes) / sizeof(int)))
+
+typedef struct pool_chunk { struct pool_chunk* next; } pool_chunk;
+
+typedef struct {
+    pool_chunk* free[POOL_CLASSES]; // recycled chunks of each size class
+    char* slab_pos; // unused part of the current slab
+    char* slab_end;
+    void** slabs; // every slab so far, freed on exit
+    int slabs_count;
+    long bytes; // handed out and not freed yet, plus what pool_count was told about
+} pool_state;
+
+static THREAD_LOCAL pool_state pool;
+
+// size class for an allocation, -1 if it is too big for the pool
+static int pool_class(size_t size) {
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        if (size <= (size_t) pool_sizes[i]) { return i; }
+    }
+    return -1;
+}
+
+void* pool_alloc(size_t size) {
+    if (size == 0) { return NULL; }
+    pool.bytes += size;
+#ifdef NO_POOL
+    return malloc(size);
+#else
+    int c = pool_class(size);
+    if (c < 0) { return malloc(size); }
+    if (pool.free[c]) {
+        pool_chunk* chunk = pool.free[c];
+        pool.free[c] = chunk->next;
+        return chunk;
+    }
+    // carve a new chunk off the current slab, starting a new slab if it is used up
+    if (pool.slab_end - pool.slab_pos < pool_sizes[c]) {
+        pool.slabs = realloc(pool.slabs, sizeof(void*) * (pool.slabs_count + 1));
+        pool.slab_pos = malloc(POOL_SLAB_SIZE);
+        pool.slab_end = pool.slab_pos + POOL_SLAB_SIZE;
+        pool.slabs[pool.slabs_count++] = pool.slab_pos;
+    }
+    void* chunk = pool.slab_pos;
+    pool.slab_pos += pool_sizes[c];
+    return chunk;
+#endif
+}
+
+// size must be the size the memory was allocated (or last reallocated) with
+void pool_free(void* p, size_t size) {
+    if (!p) { return; }
+    pool.bytes -= size;
+#ifdef NO_POOL
+    free(p);
+#else
+    int c = pool_class(size);
+    if (c < 0) { free(p); return; }
+    pool_chunk* chunk = p;
+    chunk->next = pool.free[c];
+    pool.free[c] = chunk;
+#endif
+}
+
+void* pool_realloc(void* p, size_t old_size, size_t new_size) {
+#ifdef NO_POOL
+    if (!p) { return pool_alloc(new_size); }
+    if (new_size == 0) { pool_free(p, old_size); return NULL; }
+    pool.bytes += new_size - old_size;
+    return realloc(p, new_size);
+#else
+    int old_class = pool_class(old_size);
+    int new_class = pool_class(new_size);
+    if (p && new_size && (old_class < 0 ? new_class < 0 : old_class == new_class)) {
+        pool.bytes += new_size - old_size;
+        // a big block is resized by malloc, a small one still fits its chunk
+        return old_class < 0 ? realloc(p, new_size) : p;
+    }
+    void* x = pool_alloc(new_size);
+    if (p && x) { memcpy(x, p, old_size < new_size ? old_size : new_size); }
+    pool_free(p, old_size);
+    return x;
+#endif
+}
+
+// for memory a heap object holds that did not come from the pool, so pool.bytes covers the whole heap
+static inline void pool_count(long bytes) { pool.bytes += bytes; }
+
+// hands every slab back to malloc, only once nothing on the heap is used any more
+void pool_free_all(void) {
+    for (int i = 0; i < pool.slabs_count; i++) { free(pool.slabs[i]); }
+    free(pool.slabs);
+    memset(&pool, 0, sizeof(pool));
+}
+
+/* Bytecode
+ * a list that is evaluated as code is compiled once into a small stack machine
+ * program and the program is kept in the code table, keyed on the list itself,
+ * until the list is freed. lists never change once they are visible so the
+ * program stays valid for as long as the list lives.
+*/
+enum { OP_CONST, OP_LOCAL, OP_OUTER, OP_LOOKUP, OP_EMPTY, OP_CALL, OP_TAILCALL, OP_RETURN };
+
+typedef struct {
+    int* code; // opcodes, each followed by its operands
+    int count;
+    lval** consts; // literals and symbols of the list, owned by the list
+    int consts_count;
+    lval** scope; // formals of the frame and its enclosing frames, as resolved against
+    int depth;
+} lcode; // allocated in one block with its arrays
+
+typedef struct {
+    int count;
+    int cap; // zero or a power of two
+    lval** keys; // compiled lists, NULL marks an empty slot
+    lcode** codes;
+} codetab;
+
+static THREAD_LOCAL codetab codes;
+
+static unsigned long code_hash(lval* v) {
+    return ((uintptr_t) v >> 4) * 2654435761u;
+}
+
+// slot holding v, or the empty slot where it would go. codes.cap must be > 0
+static int code_slot(lval* v) {
+    int i = code_hash(v) & (codes.cap - 1);
+    while (codes.keys[i] && codes.keys[i] != v) {
+        i = (i + 1) & (codes.cap - 1);
+    }
+    return i;
+}
+
+static lcode* code_find(lval* v) {
+    // a worker keeps the programs of the main thread's lists in its own table
+    if (!v->compiled && !PAR_SHARED(v)) { return NULL; }
+    if (!codes.cap) { return NULL; }
+    int i = code_slot(v);
+    return codes.keys[i] ? codes.codes[i] : NULL;
+}
+
+static void code_insert(lval* v, lcode* c) {
+    // keep the load factor under 1/2 so probe sequences stay short
+    if ((codes.count + 1) * 2 > codes.cap) {
+        codetab old = codes;
+        codes.cap = old.cap ? old.cap * 2 : 256;
+        codes.keys = calloc(codes.cap, sizeof(lval*));
+        codes.codes = malloc(sizeof(lcode*) * codes.cap);
+        for (int i = 0; i < old.cap; i++) {
+            if (old.keys[i]) {
+                int j = code_slot(old.keys[i]);
+                codes.keys[j] = old.keys[i];
+                codes.codes[j] = old.codes[i];
+            }
+        }
+        free(old.keys);
+        free(old.codes);
+    }
+    int i = code_slot(v);
+    codes.keys[i] = v;
+    codes.codes[i] = c;
+    codes.count++;
+    if (!PAR_SHARED(v)) { v->compiled = 1; }
+}
+
+// drops the program of a list that is being freed
+static void code_remove(lval* v) {
+    if (!codes.cap) { return; }
+    int i = code_slot(v);
+    if (!codes.keys[i]) { return; } // not compiled on this thread
+    free(codes.codes[i]);
+    codes.keys[i] = NULL;
+    codes.count--;
+    // shift later entries of the probe sequence back into the hole
+    int j = i;
+    for (;;) {
+        j = (j + 1) & (codes.cap - 1);
+        if (!codes.keys[j]) { break; }
+        int home = code_hash(codes.keys[j]) & (codes.cap - 1);
+        // the entry stays put if its home slot lies cyclically in (i, j]
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) { continue; }
+        codes.keys[i] = codes.keys[j];
+        codes.codes[i] = codes.codes[j];
+        codes.keys[j] = NULL;
+        i = j;
+    }
+}
+
+#ifndef NO_THREADS
+// drops every program, a worker's table only lasts for one parallel call
+static void code_clear(void) {
+    for (int i = 0; i < codes.cap; i++) {
+        if (codes.keys[i]) {
+            if (!PAR_SHARED(codes.keys[i])) { codes.keys[i]->compiled = 0; }
+            free(codes.codes[i]);
+            codes.keys[i] = NULL;
+        }
+    }
+    codes.count = 0;
+}
+#endif
+
+/* the machine keeps its own stack of values and of frames, so calling a lambda
+ * does not use any C stack. a frame runs the program of one list in one
+ * environment.
+*/
+typedef struct {
+    lval* expr; // the list being run, keeps its program alive
+    lcode* code;
+    int pc;
+    lenv* env;
+    int lexical; // env has the formals code was resolved against
+    int base; // height of the value stack when the frame started
+} vm_frame;
+
+typedef struct {
+    lval** stack;
+    int sp;
+    int stack_cap;
+    vm_frame* frames;
+    int fp;
+    int frames_cap;
+} vm_state;
+
+static THREAD_LOCAL vm_state vm;
+
+/* Garbage collection
+ * every lval and lenv is linked into a heap list when it is created and nothing
+ * is freed by hand. once enough objects have been allocated since the last
+ * collection the collector marks everything reachable from the roots and frees
+ * the rest, objects never move.
+ *
+ * the roots are the global environment, the stacks of the bytecode machine and
+ * the eval stack, a stack of pointers to C variables holding values in the
+ * middle of an evaluation. a collection only starts while lisp code is being
+ * evaluated, so a C variable needs to be on the eval stack only if it is held
+ * across a call that can evaluate lisp code.
+*/
+#ifndef GC_MIN_THRESHOLD
+#define GC_MIN_THRESHOLD 100000 // objects allocated before the first collection
+#endif
+#ifndef GC_GROWTH
+#define GC_GROWTH 2 // collect again once the heap is this many times the live set
+#endif
+
+typedef struct {
+    void* slot; // address of an lval* or lenv* variable
+    int is_env;
+} gc_root;
+
+typedef struct {
+    lval* vals; // every lval, linked through gc_next
+    lenv* envs; // every lenv, linked through gc_next
+    lenv* global;
+
+    gc_root* roots; // the eval stack
+    int roots_count;
+    int roots_cap;
+
+    lval** gray; // marked lvals whose children still need marking
+    int gray_count;
+    int gray_cap;
+
+    long objects; // lvals and lenvs on the heap, its size in bytes is pool.bytes
+    long threshold; // collect once objects goes over this
+
+    long collections;
+    double pause_total; // seconds
+    double pause_max;
+} gc_state;
+
+static THREAD_LOCAL gc_state gc = { .threshold = GC_MIN_THRESHOLD };
+
+static void gc_push_root(void* slot, int is_env) {
+    if (gc.roots_count == gc.roots_cap) {
+        gc.roots_cap = gc.roots_cap ? gc.roots_cap * 2 : 256;
+        gc.roots = realloc(gc.roots, sizeof(gc_root) * gc.roots_cap);
+    }
+    gc.roots[gc.roots_count].slot = slot;
+    gc.roots[gc.roots_count].is_env = is_env;
+    gc.roots_count++;
+}
+
+// keep *v alive across evaluation, pop with gc_restore
+void gc_root_val(lval** v) { gc_push_root(v, 0); }
+void gc_root_env(lenv** e) { gc_push_root(e, 1); }
+
+// height of the eval stack, everything pushed after it is popped by gc_restore
+int gc_save(void) { return gc.roots_count; }
+void gc_restore(int height) { gc.roots_count = height; }
+
+static void gc_mark_val(lval* v) {
+    if (!v || lval_is_fixnum(v) || v->mark) { return; }
+    v->mark = 1;
+    if (gc.gray_count == gc.gray_cap) {
+        gc.gray_cap = gc.gray_cap ? gc.gray_cap * 2 : 1024;
+        gc.gray = realloc(gc.gray, sizeof(lval*) * gc.gray_cap);
+    }
+    gc.gray[gc.gray_count++] = v;
+}
+
+// walks out through the enclosing frames, the values go on the gray stack
+static void gc_mark_env(lenv* e) {
+    while (e && !e->mark) {
+        e->mark = 1;
+        for (int i = 0; i < e->cap; i++) {
+            if (e->symbols[i]) { gc_mark_val(e->values[i]); }
+        }
+        if (e->names) {
+            gc_mark_val(e->names);
+            for (int i = 0; i < e->arity; i++) { gc_mark_val(e->slots[i]); }
+        }
+        e = e->outer;
+    }
+}
+
+/* marking uses an explicit stack instead of recursion so deeply nested lists
+ * cannot overflow the C stack */
+static void gc_trace(void) {
+    while (gc.gray_count) {
+        lval* v = gc.gray[--gc.gray_count];
+        switch (v->type) {
+            case LVAL_FUNC:
+                if (!v->builtin) {
+                    gc_mark_env(v->env);
+                    gc_mark_val(v->params);
+                    gc_mark_val(v->body);
+                }
+                break;
+            case LVAL_VEC:
+                gc_mark_val(v->vroot);
+                break;
+            case LVAL_MAP:
+                gc_mark_val(v->mroot);
+                break;
+            case LVAL_SEXPR:
+            case LVAL_QEXPR:
+            case LVAL_VNODE:
+            case LVAL_MNODE:
+                for (int i = 0; i < v->count; i++) { gc_mark_val(v->cell[i]); }
+                if (v->owner) { gc_mark_val(v->owner); } // keeps the buffer alive
+                break;
+        }
+    }
+}
+
+// the bytes v holds outside the pool, counted with pool_count when it is made and when it is freed
+static long lval_payload(lval* v) {
+    switch (v->type) {
+        case LVAL_ERR: return strlen(v->err) + 1;
+        case LVAL_STR: return strlen(v->str) + 1;
+        case LVAL_BIG: return sizeof(uint32_t) * v->len;
+        default: return 0;
+    }
+}
+
+static void lval_free(lval* v) {
+    pool_count(-lval_payload(v));
+    switch (v->type) {
+        case LVAL_ERR: free(v->err); break;
+        case LVAL_STR: free(v->str); break;
+        case LVAL_BIG: free(v->limbs); break;
+        case LVAL_QEXPR: // the children are freed by the sweep if nothing else holds them
+        case LVAL_SEXPR:
+        case LVAL_VNODE:
+        case LVAL_MNODE:
+            if (!v->owner) { pool_free(v->cell - v->off, sizeof(lval*) * v->cap); }
+            if (v->compiled) { code_remove(v); }
+            if (v->consed) { cons_remove(v); }
+            break;
+    }
+    pool_free(v, sizeof(lval));
+}
+
+static void lenv_free(lenv* e) {
+    pool_free(e->symbols, sizeof(char*) * e->cap);
+    pool_free(e->values, sizeof(lval*) * e->cap);
+    pool_free(e->slots, sizeof(lval*) * e->arity);
+    pool_free(e, sizeof(lenv));
+}
+
+// frees every unmarked object and clears the marks on the survivors
+static void gc_sweep(void) {
+    lval** v = &gc.vals;
+    while (*v) {
+        lval* x = *v;
+        if (x->mark) {
+            x->mark = 0;
+            v = &x->gc_next;
+        } else {
+            *v = x->gc_next;
+            lval_free(x);
+            gc.objects--;
+        }
+    }
+    lenv** e = &gc.envs;
+    while (*e) {
+        lenv* x = *e;
+        if (x->mark) {
+            x->mark = 0;
+            e = &x->gc_next;
+        } else {
+            *e = x->gc_next;
+            lenv_free(x);
+            gc.objects--;
+        }
+    }
+}
+
+// marks everything reachable from the roots
+static void gc_mark(void) {
+    gc_mark_env(gc.global);
+    for (int i = 0; i < gc.roots_count; i++) {
+        if (gc.roots[i].is_env) {
+            gc_mark_env(*(lenv**) gc.roots[i].slot);
+        } else {
+            lval* v = *(lval**) gc.roots[i].slot;
+            if (v) { gc_mark_val(v); }
+        }
+    }
+    for (int i = 0; i < vm.sp; i++) { gc_mark_val(vm.stack[i]); }
+    for (int i = 0; i < vm.fp; i++) {
+        gc_mark_env(vm.frames[i].env);
+        gc_mark_val(vm.frames[i].expr);
+    }
+    gc_trace();
+}
+
+// frees what gc_mark left unmarked, the collection took from start until now
+static void gc_finish(clock_t start) {
+    gc_sweep();
+
+    gc.threshold = gc.objects * GC_GROWTH;
+    if (gc.threshold < GC_MIN_THRESHOLD) { gc.threshold = GC_MIN_THRESHOLD; }
+
+    double pause = (double) (clock() - start) / CLOCKS_PER_SEC;
+    gc.collections++;
+    gc.pause_total += pause;
+    if (pause > gc.pause_max) { gc.pause_max = pause; }
+}
+
+void gc_collect(void) {
+    clock_t start = clock();
+    gc_mark();
+    gc_finish(start);
+}
+
+static void gc_maybe_collect(void) {
+    if (gc.objects > gc.threshold) { gc_collect(); }
+}
+
+// frees the whole heap, used on exit
+void gc_free_all(void) {
+    gc.global = NULL;
+    gc.roots_count = 0;
+    vm.sp = vm.fp = 0;
+    gc_sweep();
+    pool_free_all();
+}
+
 lenv* lenv_new(void) {
-    lenv* env = malloc(sizeof(lenv));
+    lenv* env = pool_alloc(sizeof(lenv));
+    env->mark = 0;
+    env->gc_next = gc.envs;
+    gc.envs = env;
+    gc.objects++;
     env->count = 0;
+    env->cap = 0;
     env->symbols = NULL;
     env->values = NULL;
-    env->parenv = NULL;
+    env->names = NULL;
+    env->slots = NULL;
+    env->arity = 0;
+    env->outer = NULL;
     return env;
 };
 
-void lenv_del(lenv* env) {
-    for (int i = 0; i < env->count; i++) {
-        free(env->symbols[i]);
-        lval_del(env->values[i]);
+// interned strings are unique so the address itself is the key
+static unsigned long sym_ptr_hash(char* sym) {
+    return ((unsigned long) sym >> 3) * 2654435761u;
+}
+
+// slot holding sym, or the empty slot where it would go. env->cap must be > 0
+static int lenv_slot(lenv* env, char* sym) {
+    int i = sym_ptr_hash(sym) & (env->cap - 1);
+    while (env->symbols[i] && env->symbols[i] != sym) {
+        i = (i + 1) & (env->cap - 1);
     }
-    free(env->symbols);
-    free(env->values);
-    free(env);
+    return i;
 }
 
-// takes the environment and the symbol, returns the value
-lval* lenv_get(lenv* env, lval* val) {
-    for (int i = 0; i < env->count; i++) {
-        if (strcmp(env->symbols[i], val->sym) == 0) {
-            return lval_copy(env->values[i]);
+static void lenv_grow(lenv* env) {
+    int old_cap = env->cap;
+    char** old_symbols = env->symbols;
+    lval** old_values = env->values;
+
+    env->cap = old_cap ? old_cap * 2 : 8;
+    env->symbols = pool_alloc(sizeof(char*) * env->cap);
+    env->values = pool_alloc(sizeof(lval*) * env->cap);
+    memset(env->symbols, 0, sizeof(char*) * env->cap);
+    for (int i = 0; i < old_cap; i++) {
+        if (old_symbols[i]) {
+            int j = lenv_slot(env, old_symbols[i]);
+            env->symbols[j] = old_symbols[i];
+            env->values[j] = old_values[i];
         }
     }
-    // if symbol was not found, look in parent environment
-    if (env->parenv) {
-        return lenv_get(env->parenv, val);
-    } else {
-        return lval_err("Unbound Symbol '%s'", val->sym);
+    pool_free(old_symbols, sizeof(char*) * old_cap);
+    pool_free(old_values, sizeof(lval*) * old_cap);
+}
+
+// index of sym among the formals of a call frame, or -1. a later formal of the same name wins
+int lenv_formal(lval* names, char* sym) {
+    if (!names) { return -1; }
+    for (int i = names->count - 1; i >= 0; i--) {
+        if (names->cell[i]->sym == sym) { return i; }
+    }
+    return -1;
+}
+
+// the value sym is bound to in env itself, or NULL
+static lval* lenv_find(lenv* env, char* sym) {
+    int f = lenv_formal(env->names, sym);
+    if (f >= 0) { return env->slots[f]; }
+    if (env->count == 0) { return NULL; }
+    int i = lenv_slot(env, sym);
+    return env->symbols[i] ? env->values[i] : NULL;
+}
+
+// takes the environment and the symbol, returns the value
+lval* lenv_get(lenv* env, lval* val) {
+    // if symbol is not found, look in the enclosing frames, then in the global environment
+    for (lenv* e = env; e; e = e->outer) {
+        lval* x = lenv_find(e, val->sym);
+        if (x) { return x; }
     }
+    lval* x = lenv_find(gc.global, val->sym);
+    return x ? x : lval_err("Unbound Symbol '%s'", val->sym);
 }
 
 void lenv_put(lenv* env, lval* symbol, lval* value) {
-    /* Iterate over all items in environment */
-    /* This is to see if variable already exists */
-    for (int i = 0; i < env->count; i++) {
-        /* If variable is found delete item at that position */
-        /* And replace with variable supplied by user */
-        if (strcmp(env->symbols[i], symbol->sym) == 0) {
-            lval_del(env->values[i]);
-            env->values[i] = lval_copy(value);
+    char* sym = symbol->sym;
+    if (env != gc.global) { sym_mark_local(sym); }
+    /* If variable already exists replace it with the variable supplied by user */
+    int f = lenv_formal(env->names, sym);
+    if (f >= 0) {
+        env->slots[f] = value;
+        return;
+    }
+    if (env->count) {
+        int i = lenv_slot(env, sym);
+        if (env->symbols[i]) {
+            env->values[i] = value;
             return;
         }
     }
 
-    /* If no existing entry found allocate space for new entry */
+    /* If no existing entry found make space for new entry, load factor <= 1/2 */
+    if ((env->count + 1) * 2 > env->cap) { lenv_grow(env); }
+    int i = lenv_slot(env, sym);
+    env->symbols[i] = sym;
+    env->values[i] = value;
     env->count++;
-    env->values = realloc(env->values, sizeof(lval*) * env->count);
-    env->symbols = realloc(env->symbols, sizeof(char*) * env->count);
+}
 
-    /* Copy contents of lval and symbol string into new location */
-    env->values[env->count-1] = lval_copy(value);
-    env->symbols[env->count-1] = malloc(strlen(symbol->sym)+1);
-    strcpy(env->symbols[env->count-1], symbol->sym);
+// the frame a lambda made in env closes over, nothing at top level
+lenv* lenv_closure(lenv* env) {
+    return env == gc.global ? NULL : env;
 }
 
 // defining a variable in the global scope
 void lenv_def(lenv* env, lval* symbol, lval* value) {
-    while (env->parenv) { env = env->parenv; }
-    lenv_put(env, symbol, value);
+    lenv_put(gc.global, symbol, value);
 }
 
-lenv* lenv_copy(lenv* env) {
-    lenv* new_env = malloc(sizeof(lenv));
-    new_env->parenv = env->parenv;
-    new_env->count = env->count;
-    new_env->symbols = malloc(sizeof(char*) * env->count);
-    new_env->values  = malloc(sizeof(lval*) * env->count);
-    for (int i = 0; i < env->count; i++) {
-        new_env->symbols[i] = malloc(strlen(env->symbols[i]) + 1);
-        strcpy(new_env->symbols[i], env->symbols[i]);
-        new_env->values[i] = lval_copy(env->values[i]);
-    }
-    return new_env;
+/* constructors, every new lval goes on the heap list */
+lval* lval_new(int type) {
+    lval* v = (lval*) pool_alloc(sizeof(lval));
+    v->type = type;
+    v->mark = 0;
+    v->compiled = 0;
+    v->hashed = 0;
+    v->consed = 0;
+    v->gc_next = gc.vals;
+    gc.vals = v;
+    gc.objects++;
+    return v;
 }
 
-/* constructors */
+// numbers in fixnum range never touch the heap
 lval* lval_num(long x) {
-    lval* v = (lval*) malloc(sizeof(lval));
-    v->type = LVAL_NUM;
+    if (x >= FIXNUM_MIN && x <= FIXNUM_MAX) {
+        return (lval*) (((uintptr_t) x << 1) | 1);
+    }
+    lval* v = lval_new(LVAL_NUM);
     v->num = x;
     return v;
 }
 
+lval* lval_float(double x) {
+    lval* v = lval_new(LVAL_FLOAT);
+    v->dbl = x;
+    return v;
+}
+
 lval* lval_str(char* str) {
-    lval* val = (lval*) malloc(sizeof(lval));
-    val->type = LVAL_STR;
+    lval* val = lval_new(LVAL_STR);
     val->str = (char*) malloc(strlen(str) + 1);
     strcpy(val->str, str);
+    pool_count(lval_payload(val));
     return val;
 }
 
 lval* lval_err(char* fmt, ...) {
-    lval* v = (lval*) malloc(sizeof(lval));
-    v->type = LVAL_ERR;
+    lval* v = lval_new(LVAL_ERR);
 
     /* Create a va list and initialize it */
     va_list va;
@@ -210,16 +987,18 @@ lval* lval_err(char* fmt, ...) {
 
     /* Cleanup our va list */
     va_end(va);
+    pool_count(lval_payload(v));
     return v;
 }
 
-lval* lval_sym(char* str) {
-    lval* v = (lval*) malloc(sizeof(lval));
-    v->type = LVAL_SYM;
-    v->sym = (char*) malloc(strlen(str) + 1);
-    strcpy(v->sym, str);
+// symbols point at their interned name, so they are never copied or freed
+lval* lval_sym_len(char* str, size_t len) {
+    lval* v = lval_new(LVAL_SYM);
+    v->sym = sym_intern_len(str, len);
     return v;
 }
+
+lval* lval_sym(char* str) { return lval_sym_len(str, strlen(str)); }
 /* sexpr type represents a symbolic expression defined by zero or more
  * expressions wrapped in parentheses. The constructor allocates some memory
  * for a new sexpression, which is just a single lval that has no children
@@ -228,104 +1007,1026 @@ lval* lval_sym(char* str) {
  * many children lvals which can be any valid expression (see formal grammar).
 */
 lval* lval_sexpr(void) {
-    lval* v = (lval*) malloc(sizeof(lval));
-    v->type = LVAL_SEXPR;
+    lval* v = lval_new(LVAL_SEXPR);
     v->count = 0;
+    v->off = 0;
+    v->cap = 0;
     v->cell = NULL;
+    v->owner = NULL;
     return v;
 }
 
 /* pointer to a new empty q expression */
 lval* lval_qexpr(void) {
-    lval* v = (lval*) malloc(sizeof(lval));
-    v->type = LVAL_QEXPR;
+    lval* v = lval_new(LVAL_QEXPR);
     v->count = 0;
+    v->off = 0;
+    v->cap = 0;
     v->cell = NULL;
+    v->owner = NULL;
     return v;
 }
 
+/* nil, the empty q expression. there is one, made with the builtins and never
+ * collected, and the reader hands it out for every {} (see lval_cons), so a
+ * list is nil when it is this pointer. lists that come out empty at run time
+ * are new lists, empty? checks the count and finds those too.
+*/
+lval* lval_nil;
+
 lval* lval_func(lbuiltin func) {
-    lval* val = malloc(sizeof(lval));
-    val->type = LVAL_FUNC;
+    lval* val = lval_new(LVAL_FUNC);
     val->builtin = func;
     return val;
 }
 
 lval* lval_lambda(lval* params, lval* body) {
-    lval* lambda = malloc(sizeof(lval));
-    lambda->type = LVAL_FUNC;
+    // the formals get bound in call frames, so they can no longer be assumed global
+    for (int i = 0; i < params->count; i++) { sym_mark_local(params->cell[i]->sym); }
+    lval* lambda = lval_new(LVAL_FUNC);
     lambda->builtin = NULL;
-    lambda->env = lenv_new();
+    lambda->env = NULL;
     lambda->params = params;
     lambda->body = body;
     return lambda;
 }
 
-/* deconstructor: need to free else memory leaks */
-void lval_del(lval* v) {
-    switch (v->type) {
-        case LVAL_NUM:
-            break;
-        // free the strings allocated for err and sym
-        case LVAL_ERR:
-            free(v->err);
-            break;
-        case LVAL_SYM:
-            free(v->sym);
-            break;
-        case LVAL_STR:
-            free(v->str);
-            break;
-        case LVAL_QEXPR: // qexpressions have similar semantics to sexpr, except you don't eval
-        case LVAL_SEXPR: // free each sexpr pointed to by the array of pointers: cell
-            for (int i = 0; i < v->count; i++) {
-                lval_del(v->cell[i]);
-            }
-            free(v->cell); // free the array of lval structs
-            break;
-        case LVAL_FUNC:
-            if (!v->builtin) {
-                lenv_del(v->env);
-                lval_del(v->params);
-                lval_del(v->body);
-            }
-            break; // do nothing for function pointers
+/* Bignums
+ * integers that do not fit in a long are LVAL_BIG: a sign and a magnitude of
+ * 32 bit limbs, least significant first, with no zero limbs on top. a result
+ * that fits in a long is always turned back into a plain number, so a bignum
+ * is never equal to a long and the long paths never see one.
+ *
+ * the arithmetic works on bigints, plain C values whose limbs belong to
+ * whoever made them, and only the final result is put in an lval.
+*/
+#define KARATSUBA_THRESHOLD 32 // limbs, below this schoolbook multiplication is faster
+
+typedef uint32_t limb;
+
+typedef struct {
+    int neg;
+    int len;
+    limb* limbs;
+} bigint;
+
+static int mag_trim(limb* a, int n) {
+    while (n && a[n - 1] == 0) { n--; }
+    return n;
+}
+
+static int mag_cmp(limb* a, int an, limb* b, int bn) {
+    if (an != bn) { return an < bn ? -1 : 1; }
+    for (int i = an - 1; i >= 0; i--) {
+        if (a[i] != b[i]) { return a[i] < b[i] ? -1 : 1; }
     }
-    free(v); // free memory allocated to lval struct
+    return 0;
 }
 
-/* The reader */
-lval* lval_read_num(mpc_ast_t* ast) {
-    errno = 0;
-    long x = strtol(ast->contents, NULL, 10);
-    return errno != ERANGE ? lval_num(x) : lval_err("Invalid Number");
+// r = a + b, r has room for max(an, bn) + 1 limbs and may be a
+static int mag_add(limb* a, int an, limb* b, int bn, limb* r) {
+    if (an < bn) { limb* t = a; a = b; b = t; int tn = an; an = bn; bn = tn; }
+    uint64_t carry = 0;
+    for (int i = 0; i < an; i++) {
+        carry += (uint64_t) a[i] + (i < bn ? b[i] : 0);
+        r[i] = (limb) carry;
+        carry >>= 32;
+    }
+    r[an] = (limb) carry;
+    return mag_trim(r, an + 1);
 }
 
-// remove quotes and unescape the string (convert to encoded characters)
-lval* lval_read_str(mpc_ast_t* ast) {
-    ast->contents[strlen(ast->contents)-1] = '\0';
-    char* unescaped = malloc(strlen(ast->contents+1)+1);
-    strcpy(unescaped, ast->contents+1);
-    unescaped = mpcf_unescape(unescaped);
-    lval* str = lval_str(unescaped);
-    free(unescaped);
-    return str;
+// r = a - b where a >= b, r has room for an limbs and may be a
+static int mag_sub(limb* a, int an, limb* b, int bn, limb* r) {
+    int64_t borrow = 0;
+    for (int i = 0; i < an; i++) {
+        int64_t t = (int64_t) a[i] - (i < bn ? b[i] : 0) - borrow;
+        borrow = t < 0;
+        r[i] = (limb) t;
+    }
+    return mag_trim(r, an);
 }
 
-lval* lval_add(lval* v, lval* x) {
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    v->cell[v->count - 1] = x;
-    return v;
+// adds x into r at limb offset off, r is long enough to take the carry
+static void mag_add_at(limb* r, limb* x, int xn, int off) {
+    uint64_t carry = 0;
+    int i = 0;
+    for (; i < xn; i++) {
+        carry += (uint64_t) r[off + i] + x[i];
+        r[off + i] = (limb) carry;
+        carry >>= 32;
+    }
+    for (; carry; i++) {
+        carry += r[off + i];
+        r[off + i] = (limb) carry;
+        carry >>= 32;
+    }
 }
-/* reader takes an ast from the parser, compares the tags (expr, number, regex etc)
- * and creates lval array which represents the sexpression. Don't forget
- * the ast is one giant s-expression.
- * 
- * e.g. the line: (+ 2 2) is convert to
- * root : lval sexpr | count 3 | cell [ addr1, addr2, addr3];
- * addr1: lval symbol | count undefined | cell undefined | sym +
- * addr2: lval number | count undefined | cell undefined | num 2
+
+static void mag_mul_school(limb* a, int an, limb* b, int bn, limb* r) {
+    memset(r, 0, sizeof(limb) * (an + bn));
+    for (int i = 0; i < an; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; j < bn; j++) {
+            carry += (uint64_t) a[i] * b[j] + r[i + j];
+            r[i + j] = (limb) carry;
+            carry >>= 32;
+        }
+        r[i + bn] = (limb) carry;
+    }
+}
+
+/* r = a * b, r has room for an + bn limbs. splits both halves at m limbs:
+ * a*b = z2 B^2m + ((a0 + a1)(b0 + b1) - z0 - z2) B^m + z0, three half size
+ * products instead of four */
+static void mag_mul(limb* a, int an, limb* b, int bn, limb* r) {
+    if (an < bn) { limb* t = a; a = b; b = t; int tn = an; an = bn; bn = tn; }
+    if (bn < KARATSUBA_THRESHOLD) {
+        mag_mul_school(a, an, b, bn, r);
+        return;
+    }
+    memset(r, 0, sizeof(limb) * (an + bn));
+    int m = an / 2;
+    if (bn <= m) {
+        // lopsided, multiply b by a in pieces its own size
+        limb* t = malloc(sizeof(limb) * 2 * bn);
+        for (int off = 0; off < an; off += bn) {
+            int n = an - off < bn ? an - off : bn;
+            mag_mul(a + off, n, b, bn, t);
+            mag_add_at(r, t, mag_trim(t, n + bn), off);
+        }
+        free(t);
+        return;
+    }
+
+    int a0n = mag_trim(a, m), b0n = mag_trim(b, m);
+    int a1n = an - m, b1n = bn - m;
+    limb* z0 = malloc(sizeof(limb) * 2 * m);
+    limb* z2 = malloc(sizeof(limb) * (a1n + b1n));
+    limb* sa = malloc(sizeof(limb) * (a1n + 1));
+    limb* sb = malloc(sizeof(limb) * (a1n + 1));
+    limb* z1 = malloc(sizeof(limb) * 2 * (a1n + 1));
+
+    mag_mul(a, a0n, b, b0n, z0);
+    int z0n = mag_trim(z0, a0n + b0n);
+    mag_mul(a + m, a1n, b + m, b1n, z2);
+    int z2n = mag_trim(z2, a1n + b1n);
+    int san = mag_add(a, a0n, a + m, a1n, sa);
+    int sbn = mag_add(b, b0n, b + m, b1n, sb);
+    mag_mul(sa, san, sb, sbn, z1);
+    int z1n = mag_trim(z1, san + sbn);
+    z1n = mag_sub(z1, z1n, z0, z0n, z1);
+    z1n = mag_sub(z1, z1n, z2, z2n, z1);
+
+    mag_add_at(r, z0, z0n, 0);
+    mag_add_at(r, z1, z1n, m);
+    mag_add_at(r, z2, z2n, 2 * m);
+    free(z0);
+    free(z2);
+    free(sa);
+    free(sb);
+    free(z1);
+}
+
+// q = a / d, returns a % d. q has room for an limbs and may be a
+static limb mag_divmod_small(limb* a, int an, limb d, limb* q) {
+    uint64_t rem = 0;
+    for (int i = an - 1; i >= 0; i--) {
+        uint64_t cur = (rem << 32) | a[i];
+        q[i] = (limb) (cur / d);
+        rem = cur % d;
+    }
+    return (limb) rem;
+}
+
+/* q = u / v and r = u % v by Knuth's algorithm D, v has at least two limbs
+ * and u at least as many. q has room for un - vn + 1 limbs, r for vn */
+static void mag_divmod(limb* u, int un, limb* v, int vn, limb* q, limb* r) {
+    // normalize so the top limb of v has its high bit set, which keeps qhat within 2 of the truth
+    int s = 0;
+    while (!((v[vn - 1] << s) & 0x80000000u)) { s++; }
+    limb* vs = malloc(sizeof(limb) * vn);
+    limb* us = malloc(sizeof(limb) * (un + 1));
+    for (int i = vn - 1; i > 0; i--) { vs[i] = (v[i] << s) | (s ? v[i - 1] >> (32 - s) : 0); }
+    vs[0] = v[0] << s;
+    us[un] = s ? u[un - 1] >> (32 - s) : 0;
+    for (int i = un - 1; i > 0; i--) { us[i] = (u[i] << s) | (s ? u[i - 1] >> (32 - s) : 0); }
+    us[0] = u[0] << s;
+
+    const uint64_t b = (uint64_t) 1 << 32;
+    for (int j = un - vn; j >= 0; j--) {
+        uint64_t top = ((uint64_t) us[j + vn] << 32) | us[j + vn - 1];
+        uint64_t qhat = top / vs[vn - 1];
+        uint64_t rhat = top % vs[vn - 1];
+        while (qhat >= b || qhat * vs[vn - 2] > ((rhat << 32) | us[j + vn - 2])) {
+            qhat--;
+            rhat += vs[vn - 1];
+            if (rhat >= b) { break; }
+        }
+        // multiply and subtract
+        int64_t borrow = 0, t;
+        for (int i = 0; i < vn; i++) {
+            uint64_t p = qhat * vs[i];
+            t = (int64_t) us[i + j] - borrow - (int64_t) (p & 0xFFFFFFFFu);
+            us[i + j] = (limb) t;
+            borrow = (int64_t) (p >> 32) - (t >> 32);
+        }
+        t = (int64_t) us[j + vn] - borrow;
+        us[j + vn] = (limb) t;
+        q[j] = (limb) qhat;
+        if (t < 0) {
+            // qhat was one too big, add v back
+            q[j]--;
+            uint64_t carry = 0;
+            for (int i = 0; i < vn; i++) {
+                carry += (uint64_t) us[i + j] + vs[i];
+                us[i + j] = (limb) carry;
+                carry >>= 32;
+            }
+            us[j + vn] += (limb) carry;
+        }
+    }
+    for (int i = 0; i < vn - 1; i++) { r[i] = (us[i] >> s) | (s ? us[i + 1] << (32 - s) : 0); }
+    r[vn - 1] = us[vn - 1] >> s;
+    free(vs);
+    free(us);
+}
+
+static bigint big_alloc(int n) {
+    bigint x = { 0, 0, malloc(sizeof(limb) * (n ? n : 1)) };
+    return x;
+}
+
+static void big_free(bigint* x) { free(x->limbs); }
+
+static bigint big_from_long(long v) {
+    bigint x = big_alloc(2);
+    x.neg = v < 0;
+    unsigned long m = v < 0 ? -(unsigned long) v : (unsigned long) v; // LONG_MIN too
+    while (m) {
+        x.limbs[x.len++] = (limb) m;
+        m = sizeof(m) > 4 ? m >> 16 >> 16 : 0;
+    }
+    return x;
+}
+
+// a copy of the integer v, a long or a bignum
+static bigint big_from_lval(lval* v) {
+    if (lval_type(v) != LVAL_BIG) { return big_from_long(lval_long(v)); }
+    bigint x = big_alloc(v->len);
+    x.neg = v->neg;
+    x.len = v->len;
+    memcpy(x.limbs, v->limbs, sizeof(limb) * v->len);
+    return x;
+}
+
+// the value of x as an lval, a plain number if it fits in a long. x is used up
+static lval* big_lval(bigint* x) {
+    if (x->len <= (int) (sizeof(long) / sizeof(limb))) {
+        unsigned long m = 0;
+        for (int i = x->len - 1; i >= 0; i--) { m = (sizeof(m) > 4 ? m << 16 << 16 : 0) | x->limbs[i]; }
+        if (x->neg ? m <= (unsigned long) LONG_MAX + 1 : m <= LONG_MAX) {
+            long n = x->neg ? (long) (0 - m) : (long) m;
+            big_free(x);
+            return lval_num(n);
+        }
+    }
+    lval* v = lval_new(LVAL_BIG);
+    v->neg = x->neg;
+    v->len = x->len;
+    v->limbs = realloc(x->limbs, sizeof(limb) * x->len);
+    pool_count(lval_payload(v));
+    return v;
+}
+
+static bigint big_add(bigint* a, bigint* b, int negate_b) {
+    int bneg = b->neg ^ negate_b;
+    bigint r = big_alloc((a->len > b->len ? a->len : b->len) + 1);
+    if (a->neg == bneg) {
+        r.len = mag_add(a->limbs, a->len, b->limbs, b->len, r.limbs);
+        r.neg = a->neg;
+    } else if (mag_cmp(a->limbs, a->len, b->limbs, b->len) >= 0) {
+        r.len = mag_sub(a->limbs, a->len, b->limbs, b->len, r.limbs);
+        r.neg = a->neg;
+    } else {
+        r.len = mag_sub(b->limbs, b->len, a->limbs, a->len, r.limbs);
+        r.neg = bneg;
+    }
+    if (r.len == 0) { r.neg = 0; }
+    return r;
+}
+
+static bigint big_mul(bigint* a, bigint* b) {
+    bigint r = big_alloc(a->len + b->len);
+    mag_mul(a->limbs, a->len, b->limbs, b->len, r.limbs);
+    r.len = mag_trim(r.limbs, a->len + b->len);
+    r.neg = r.len && (a->neg != b->neg);
+    return r;
+}
+
+// truncating division like C: q rounds toward zero and r takes the sign of a. b is not zero
+static void big_divmod(bigint* a, bigint* b, bigint* q, bigint* r) {
+    *q = big_alloc(a->len);
+    *r = big_alloc(b->len);
+    if (mag_cmp(a->limbs, a->len, b->limbs, b->len) < 0) {
+        memcpy(r->limbs, a->limbs, sizeof(limb) * a->len);
+        r->len = a->len;
+    } else if (b->len == 1) {
+        r->limbs[0] = mag_divmod_small(a->limbs, a->len, b->limbs[0], q->limbs);
+        q->len = mag_trim(q->limbs, a->len);
+        r->len = mag_trim(r->limbs, 1);
+    } else {
+        mag_divmod(a->limbs, a->len, b->limbs, b->len, q->limbs, r->limbs);
+        q->len = mag_trim(q->limbs, a->len - b->len + 1);
+        r->len = mag_trim(r->limbs, b->len);
+    }
+    q->neg = q->len && (a->neg != b->neg);
+    r->neg = r->len && a->neg;
+}
+
+// x <=> y for two integers, either of which may be a bignum
+int big_cmp(lval* x, lval* y) {
+    bigint a = big_from_lval(x), b = big_from_lval(y);
+    int c;
+    if (a.neg != b.neg) {
+        c = a.neg ? -1 : 1;
+    } else {
+        c = mag_cmp(a.limbs, a.len, b.limbs, b.len);
+        if (a.neg) { c = -c; }
+    }
+    big_free(&a);
+    big_free(&b);
+    return c;
+}
+
+double big_double(lval* v) {
+    double d = 0;
+    for (int i = v->len - 1; i >= 0; i--) { d = d * 4294967296.0 + v->limbs[i]; }
+    return v->neg ? -d : d;
+}
+
+// the len decimal digits at s as an lval
+lval* big_read(char* s, size_t len, int neg) {
+    bigint x = big_alloc(len / 9 + 2);
+    for (size_t i = 0; i < len; ) {
+        // nine digits at a time, a power of ten that fits in a limb
+        limb chunk = 0, scale = 1;
+        for (int k = 0; k < 9 && i < len; k++, i++) {
+            chunk = chunk * 10 + (s[i] - '0');
+            scale *= 10;
+        }
+        uint64_t carry = chunk;
+        for (int j = 0; j < x.len; j++) {
+            carry += (uint64_t) x.limbs[j] * scale;
+            x.limbs[j] = (limb) carry;
+            carry >>= 32;
+        }
+        if (carry) { x.limbs[x.len++] = (limb) carry; }
+    }
+    x.neg = neg && x.len;
+    return big_lval(&x);
+}
+
+// decimal text of a bignum, the caller frees it
+char* big_text(lval* v) {
+    int n = v->len;
+    limb* m = malloc(sizeof(limb) * n);
+    memcpy(m, v->limbs, sizeof(limb) * n);
+    // each limb is under ten decimal digits
+    char* text = malloc(n * 10 + 2);
+    char* p = text + n * 10 + 1;
+    *p = '\0';
+    while (n) {
+        limb chunk = mag_divmod_small(m, n, 1000000000u, m);
+        n = mag_trim(m, n);
+        for (int k = 0; k < 9 && (n || chunk); k++) {
+            *--p = '0' + chunk % 10;
+            chunk /= 10;
+        }
+    }
+    if (v->neg) { *--p = '-'; }
+    memmove(text, p, strlen(p) + 1);
+    free(m);
+    return text;
+}
+
+/* the overflow checked long operations the arithmetic tries first, they return
+ * 1 if the result does not fit, and r is then unspecified: the builtins wrap it,
+ * the portable versions leave it alone. callers start over with bignums */
+static inline int long_add(long a, long b, long* r) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_add_overflow(a, b, r);
+#else
+    if ((b > 0 && a > LONG_MAX - b) || (b < 0 && a < LONG_MIN - b)) { return 1; }
+    *r = a + b;
+    return 0;
+#endif
+}
+
+static inline int long_sub(long a, long b, long* r) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_sub_overflow(a, b, r);
+#else
+    if ((b < 0 && a > LONG_MAX + b) || (b > 0 && a < LONG_MIN + b)) { return 1; }
+    *r = a - b;
+    return 0;
+#endif
+}
+
+static inline int long_mul(long a, long b, long* r) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_mul_overflow(a, b, r);
+#else
+    if (a > 0 ? (b > 0 ? a > LONG_MAX / b : b < LONG_MIN / a)
+            : (b > 0 ? a < LONG_MIN / b : a != 0 && b < LONG_MAX / a)) { return 1; }
+    *r = a * b;
+    return 0;
+#endif
+}
+
+/* folds op over the integers in a[0..n), some of which may be bignums or
+ * overflow a long on the way. op is one of + - * / %, - with one argument
+ * negates. */
+lval* big_fold(char op, lval** a, int n) {
+    bigint x = big_from_lval(a[0]);
+    if (op == '-' && n == 1) {
+        x.neg = x.len && !x.neg;
+        return big_lval(&x);
+    }
+    for (int i = 1; i < n; i++) {
+        bigint y = big_from_lval(a[i]);
+        bigint r, q;
+        if ((op == '/' || op == '%') && y.len == 0) {
+            big_free(&x);
+            big_free(&y);
+            return lval_err("Division By Zero");
+        }
+        switch (op) {
+            case '+': r = big_add(&x, &y, 0); break;
+            case '-': r = big_add(&x, &y, 1); break;
+            case '*': r = big_mul(&x, &y); break;
+            case '/': big_divmod(&x, &y, &r, &q); big_free(&q); break;
+            default: big_divmod(&x, &y, &q, &r); big_free(&q); break;
+        }
+        big_free(&x);
+        big_free(&y);
+        x = r;
+    }
+    return big_lval(&x);
+}
+
+/* Vectors
+ * a persistent vector is a trie of 32 way nodes with the elements in the
+ * leaves, so an index is split into 5 bit digits and get, set and push touch
+ * one node per level: a million elements are four levels deep. set and push
+ * copy only the nodes on the path to the element and share the rest with the
+ * vector they started from.
+ *
+ * nodes are LVAL_VNODE lvals laid out like a list with a fixed buffer of 32
+ * cells, so the collector marks and frees them the same way. they never
+ * escape to lisp code, only the LVAL_VEC holding the root does.
+*/
+#define VEC_BITS 5
+#define VEC_WIDTH (1 << VEC_BITS)
+#define VEC_MASK (VEC_WIDTH - 1)
+
+static lval* vnode_new(void) {
+    lval* n = lval_new(LVAL_VNODE);
+    n->count = 0;
+    n->off = 0;
+    n->cap = VEC_WIDTH;
+    n->cell = pool_alloc(sizeof(lval*) * VEC_WIDTH);
+    n->owner = NULL;
+    return n;
+}
+
+static lval* vnode_copy(lval* n) {
+    lval* c = vnode_new();
+    c->count = n->count;
+    memcpy(c->cell, n->cell, sizeof(lval*) * n->count);
+    return c;
+}
+
+lval* lval_vec(lval* root, long count, int shift) {
+    lval* v = lval_new(LVAL_VEC);
+    v->vroot = root;
+    v->vcount = count;
+    v->vshift = shift;
+    return v;
+}
+
+// the element at i, which must be in range
+lval* vec_get(lval* v, long i) {
+    lval* n = v->vroot;
+    for (int level = v->vshift; level > 0; level -= VEC_BITS) {
+        n = n->cell[(i >> level) & VEC_MASK];
+    }
+    return n->cell[i & VEC_MASK];
+}
+
+static lval* vnode_set(lval* n, int level, long i, lval* x) {
+    lval* c = vnode_copy(n);
+    if (level == 0) {
+        c->cell[i & VEC_MASK] = x;
+    } else {
+        int sub = (i >> level) & VEC_MASK;
+        c->cell[sub] = vnode_set(n->cell[sub], level - VEC_BITS, i, x);
+    }
+    return c;
+}
+
+// v with the element at i, which must be in range, replaced by x
+lval* vec_set(lval* v, long i, lval* x) {
+    return lval_vec(vnode_set(v->vroot, v->vshift, i, x), v->vcount, v->vshift);
+}
+
+// a chain of single child nodes from level down to a leaf holding x
+static lval* vnode_path(int level, lval* x) {
+    lval* n = vnode_new();
+    n->cell[n->count++] = level == 0 ? x : vnode_path(level - VEC_BITS, x);
+    return n;
+}
+
+static lval* vnode_push(lval* n, int level, long i, lval* x) {
+    lval* c = vnode_copy(n);
+    if (level == 0) {
+        c->cell[c->count++] = x;
+    } else {
+        int sub = (i >> level) & VEC_MASK;
+        if (sub < n->count) {
+            c->cell[sub] = vnode_push(n->cell[sub], level - VEC_BITS, i, x);
+        } else {
+            c->cell[c->count++] = vnode_path(level - VEC_BITS, x);
+        }
+    }
+    return c;
+}
+
+// v with x added at the end
+lval* vec_push(lval* v, lval* x) {
+    long i = v->vcount;
+    if (i == (long) VEC_WIDTH << v->vshift) {
+        // the trie is full, it grows a level at the top
+        lval* root = vnode_new();
+        root->cell[root->count++] = v->vroot;
+        root->cell[root->count++] = vnode_path(v->vshift, x);
+        return lval_vec(root, i + 1, v->vshift + VEC_BITS);
+    }
+    return lval_vec(vnode_push(v->vroot, v->vshift, i, x), i + 1, v->vshift);
+}
+
+// a vector of the n values at items, built a level at a time from the leaves up
+lval* vec_from(lval** items, long n) {
+    long count = (n + VEC_MASK) / VEC_WIDTH;
+    if (count == 0) { return lval_vec(vnode_new(), 0, 0); }
+    lval** level = malloc(sizeof(lval*) * count);
+    for (long j = 0; j < count; j++) {
+        level[j] = vnode_new();
+        long k = n - j * VEC_WIDTH < VEC_WIDTH ? n - j * VEC_WIDTH : VEC_WIDTH;
+        memcpy(level[j]->cell, items + j * VEC_WIDTH, sizeof(lval*) * k);
+        level[j]->count = k;
+    }
+    int shift = 0;
+    while (count > 1) {
+        long parents = (count + VEC_MASK) / VEC_WIDTH;
+        for (long j = 0; j < parents; j++) {
+            lval* p = vnode_new();
+            for (long k = j * VEC_WIDTH; k < count && k < (j + 1) * VEC_WIDTH; k++) {
+                p->cell[p->count++] = level[k];
+            }
+            level[j] = p;
+        }
+        count = parents;
+        shift += VEC_BITS;
+    }
+    lval* root = level[0];
+    free(level);
+    return lval_vec(root, n, shift);
+}
+
+/* Hashing
+ * lval_hash agrees with lval_eq: values that are equal hash the same. numbers
+ * hash by the value lval_eq compares, as a double, so 1, 1.0 and a bignum one
+ * hash alike (integers past 2^53 that round to the same double collide, which
+ * only costs a comparison). strings and symbols by their text (so a map's order is the
+ * same from run to run), lists and vectors by their elements in order and maps
+ * by their entries in any order. a list keeps its hash once it is worked out,
+ * lval_add and lval_pop forget it again.
+*/
+static uint32_t hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t) h;
+}
+
+static uint32_t hash_text(const char* s, uint32_t h) {
+    while (*s) { h = (h ^ (unsigned char) *s++) * 16777619u; } // FNV-1a
+    return h;
+}
+
+static inline uint32_t hash_combine(uint32_t h, uint32_t x) {
+    return h ^ (x + 0x9e3779b9u + (h << 6) + (h >> 2));
+}
+
+lval** map_entries(lval* m);
+
+uint32_t lval_hash(lval* v) {
+    int type = lval_type(v);
+    uint32_t h = 2166136261u + type;
+    switch (type) {
+        case LVAL_NUM:
+        case LVAL_FLOAT:
+        case LVAL_BIG: {
+            double d = lval_double(v);
+            if (d == 0) { d = 0; } // -0.0 == 0.0
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            return hash_mix(bits);
+        }
+        case LVAL_ERR: return hash_text(v->err, h);
+        case LVAL_SYM: return hash_text(v->sym, h);
+        case LVAL_STR: return hash_text(v->str, h);
+        case LVAL_FUNC:
+            if (v->builtin) { return hash_mix((uintptr_t) v->builtin); }
+            return hash_combine(lval_hash(v->params), lval_hash(v->body));
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            if (v->hashed) { return v->hash; }
+            for (int i = 0; i < v->count; i++) { h = hash_combine(h, lval_hash(v->cell[i])); }
+            if (!PAR_SHARED(v)) {
+                v->hash = h;
+                v->hashed = 1;
+            }
+            return h;
+        case LVAL_VEC:
+            for (long i = 0; i < v->vcount; i++) { h = hash_combine(h, lval_hash(vec_get(v, i))); }
+            return h;
+        case LVAL_MAP: {
+            lval** e = map_entries(v);
+            for (long i = 0; i < v->mcount; i++) {
+                h += hash_mix(((uint64_t) lval_hash(e[2 * i]) << 32) | lval_hash(e[2 * i + 1]));
+            }
+            free(e);
+            return h;
+        }
+    }
+    return h;
+}
+
+/* hash consing: the reader looks every Q-Expression it finishes up in a table
+ * of the ones already read, and hands out the one in the table if there is an
+ * equal one, so a literal repeated across a program is stored once. lists in
+ * the table never change, so two different ones are never equal and lval_eq
+ * tells them apart without looking inside. equal has to mean identical here or
+ * the reader would rewrite a literal, and floats are the exception: -0.0 equals
+ * 0.0, a whole float equals the integer of its value and NaN equals nothing, so
+ * a list holding any of them stays out of the table.
+ * the table does not keep its lists alive, lval_free takes them out.
+*/
+typedef struct {
+    int count;
+    int cap; // zero or a power of two
+    lval** keys; // NULL marks an empty slot
+} constab;
+
+static constab conses;
+
+// slot holding v itself, or the empty slot where it would go
+static int cons_slot(lval* v) {
+    int i = v->hash & (conses.cap - 1);
+    while (conses.keys[i] && conses.keys[i] != v) {
+        i = (i + 1) & (conses.cap - 1);
+    }
+    return i;
+}
+
+// true if v holds, at any depth, a float that equals a value not identical to it
+static int cons_unsafe(lval* v) {
+    for (int i = 0; i < v->count; i++) {
+        lval* x = v->cell[i];
+        switch (lval_type(x)) {
+            case LVAL_FLOAT:
+                if (x->dbl != x->dbl || x->dbl == floor(x->dbl)) { return 1; } // NaN, whole or infinite
+                break;
+            case LVAL_SEXPR:
+            case LVAL_QEXPR:
+                if (!x->consed && cons_unsafe(x)) { return 1; }
+                break;
+        }
+    }
+    return 0;
+}
+
+// the list in the table equal to the new list v, v itself after adding it if there is none
+lval* lval_cons(lval* v) {
+    if (cons_unsafe(v)) { return v; }
+    uint32_t h = lval_hash(v);
+    for (int i = h & (conses.cap - 1); conses.cap && conses.keys[i]; i = (i + 1) & (conses.cap - 1)) {
+        lval* x = conses.keys[i];
+        // the table is weak, to a worker only what the main thread marked is still alive
+        if (par_worker && !PAR_SHARED(x)) { continue; }
+        if (x->hash == h && lval_eq(x, v)) { return x; }
+    }
+    // only lists of the main thread go in, the table is read only while workers run
+    if (par_worker) { return v; }
+    if ((conses.count + 1) * 2 > conses.cap) {
+        constab old = conses;
+        conses.cap = old.cap ? old.cap * 2 : 256;
+        conses.keys = calloc(conses.cap, sizeof(lval*));
+        for (int i = 0; i < old.cap; i++) {
+            if (old.keys[i]) { conses.keys[cons_slot(old.keys[i])] = old.keys[i]; }
+        }
+        free(old.keys);
+    }
+    conses.keys[cons_slot(v)] = v;
+    conses.count++;
+    v->consed = 1;
+    return v;
+}
+
+void cons_remove(lval* v) {
+    int i = cons_slot(v);
+    conses.keys[i] = NULL;
+    conses.count--;
+    // shift later entries of the probe sequence back into the hole, as code_remove does
+    int j = i;
+    for (;;) {
+        j = (j + 1) & (conses.cap - 1);
+        if (!conses.keys[j]) { break; }
+        int home = conses.keys[j]->hash & (conses.cap - 1);
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) { continue; }
+        conses.keys[i] = conses.keys[j];
+        conses.keys[j] = NULL;
+        i = j;
+    }
+}
+
+/* Maps
+ * a hash map is a hash array mapped trie: the 32 bit hash of a key is split
+ * into 5 bit digits and each node has a bitmap of the digits it holds an entry
+ * for, so it stores only those. an entry takes two cells, a key and its value,
+ * or NULL and the node below. like vectors, put and delete copy only the nodes
+ * on the path to the key and share everything else with the map they started
+ * from.
+ *
+ * keys whose hashes are the same in all 32 bits end up together in a node
+ * past the last digit, which is a plain list of pairs without a bitmap. a node
+ * never holds less than one entry, a map with nothing in it has no root.
+ *
+ * keys are compared with lval_eq, so 1 and 1.0 are the same key.
+*/
+#define MAP_BITS 5
+#define MAP_MASK ((1 << MAP_BITS) - 1)
+#define MAP_HASH_BITS 32
+
+static inline int map_popcount(uint32_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcount(x);
+#else
+    int n = 0;
+    for (; x; x &= x - 1) { n++; }
+    return n;
+#endif
+}
+
+static lval* mnode_new(uint32_t bitmap, int cells) {
+    lval* n = lval_new(LVAL_MNODE);
+    n->count = cells;
+    n->off = 0;
+    n->cap = cells;
+    n->bitmap = bitmap;
+    n->cell = pool_alloc(sizeof(lval*) * cells);
+    n->owner = NULL;
+    return n;
+}
+
+static lval* mnode_copy(lval* n) {
+    lval* c = mnode_new(n->bitmap, n->count);
+    memcpy(c->cell, n->cell, sizeof(lval*) * n->count);
+    return c;
+}
+
+// n with a key and value put in at cell i, or the entry at i taken out
+static lval* mnode_insert(lval* n, uint32_t bitmap, int i, lval* k, lval* v) {
+    lval* c = mnode_new(bitmap, n->count + 2);
+    memcpy(c->cell, n->cell, sizeof(lval*) * i);
+    c->cell[i] = k;
+    c->cell[i + 1] = v;
+    memcpy(c->cell + i + 2, n->cell + i, sizeof(lval*) * (n->count - i));
+    return c;
+}
+
+static lval* mnode_remove(lval* n, uint32_t bitmap, int i) {
+    lval* c = mnode_new(bitmap, n->count - 2);
+    memcpy(c->cell, n->cell, sizeof(lval*) * i);
+    memcpy(c->cell + i, n->cell + i + 2, sizeof(lval*) * (n->count - i - 2));
+    return c;
+}
+
+lval* lval_map(lval* root, long count) {
+    lval* m = lval_new(LVAL_MAP);
+    m->mroot = root;
+    m->mcount = count;
+    return m;
+}
+
+// the value of k in m, NULL if k is not there
+lval* map_get(lval* m, lval* k) {
+    uint32_t h = lval_hash(k);
+    lval* n = m->mroot;
+    for (int shift = 0; n; shift += MAP_BITS) {
+        if (shift >= MAP_HASH_BITS) {
+            for (int i = 0; i < n->count; i += 2) {
+                if (lval_eq(n->cell[i], k)) { return n->cell[i + 1]; }
+            }
+            return NULL;
+        }
+        uint32_t bit = 1u << ((h >> shift) & MAP_MASK);
+        if (!(n->bitmap & bit)) { return NULL; }
+        int i = 2 * map_popcount(n->bitmap & (bit - 1));
+        if (n->cell[i]) { return lval_eq(n->cell[i], k) ? n->cell[i + 1] : NULL; }
+        n = n->cell[i + 1];
+    }
+    return NULL;
+}
+
+static lval* mnode_put(lval* n, int shift, uint32_t h, lval* k, lval* v, int* added) {
+    if (shift >= MAP_HASH_BITS) {
+        for (int i = 0; n && i < n->count; i += 2) {
+            if (lval_eq(n->cell[i], k)) {
+                lval* c = mnode_copy(n);
+                c->cell[i + 1] = v;
+                return c;
+            }
+        }
+        *added = 1;
+        if (!n) {
+            n = mnode_new(0, 2);
+            n->cell[0] = k;
+            n->cell[1] = v;
+            return n;
+        }
+        return mnode_insert(n, 0, n->count, k, v);
+    }
+    uint32_t bit = 1u << ((h >> shift) & MAP_MASK);
+    if (!n) {
+        *added = 1;
+        n = mnode_new(bit, 2);
+        n->cell[0] = k;
+        n->cell[1] = v;
+        return n;
+    }
+    int i = 2 * map_popcount(n->bitmap & (bit - 1));
+    if (!(n->bitmap & bit)) {
+        *added = 1;
+        return mnode_insert(n, n->bitmap | bit, i, k, v);
+    }
+    lval* c = mnode_copy(n);
+    if (!n->cell[i]) {
+        c->cell[i + 1] = mnode_put(n->cell[i + 1], shift + MAP_BITS, h, k, v, added);
+    } else if (lval_eq(n->cell[i], k)) {
+        c->cell[i + 1] = v;
+    } else {
+        // two keys share this digit, both move down into a new node
+        int moved = 0;
+        lval* sub = mnode_put(NULL, shift + MAP_BITS, lval_hash(n->cell[i]), n->cell[i], n->cell[i + 1], &moved);
+        c->cell[i] = NULL;
+        c->cell[i + 1] = mnode_put(sub, shift + MAP_BITS, h, k, v, added);
+    }
+    return c;
+}
+
+// m with k bound to v, in place of any value k had
+lval* map_put(lval* m, lval* k, lval* v) {
+    int added = 0;
+    lval* root = mnode_put(m->mroot, 0, lval_hash(k), k, v, &added);
+    return lval_map(root, m->mcount + (added ? 1 : 0));
+}
+
+/* n without k: n itself if k is not there and NULL if nothing is left. a node
+ * left with a single key and value is pulled up into its parent, so the trie
+ * stays as shallow as it would have been had the key never been put in. */
+static lval* mnode_delete(lval* n, int shift, uint32_t h, lval* k) {
+    if (shift >= MAP_HASH_BITS) {
+        for (int i = 0; i < n->count; i += 2) {
+            if (lval_eq(n->cell[i], k)) { return n->count == 2 ? NULL : mnode_remove(n, 0, i); }
+        }
+        return n;
+    }
+    uint32_t bit = 1u << ((h >> shift) & MAP_MASK);
+    if (!(n->bitmap & bit)) { return n; }
+    int i = 2 * map_popcount(n->bitmap & (bit - 1));
+    if (n->cell[i]) {
+        if (!lval_eq(n->cell[i], k)) { return n; }
+        return n->count == 2 ? NULL : mnode_remove(n, n->bitmap & ~bit, i);
+    }
+    lval* sub = mnode_delete(n->cell[i + 1], shift + MAP_BITS, h, k);
+    if (sub == n->cell[i + 1]) { return n; }
+    if (!sub) { return n->count == 2 ? NULL : mnode_remove(n, n->bitmap & ~bit, i); }
+    lval* c = mnode_copy(n);
+    if (sub->count == 2 && sub->cell[0]) {
+        c->cell[i] = sub->cell[0];
+        c->cell[i + 1] = sub->cell[1];
+    } else {
+        c->cell[i + 1] = sub;
+    }
+    return c;
+}
+
+// m without k
+lval* map_delete(lval* m, lval* k) {
+    if (!m->mroot) { return m; }
+    lval* root = mnode_delete(m->mroot, 0, lval_hash(k), k);
+    if (root == m->mroot) { return m; }
+    return lval_map(root, m->mcount - 1);
+}
+
+static void mnode_entries(lval* n, lval** e, long* count) {
+    for (int i = 0; i < n->count; i += 2) {
+        if (n->cell[i]) {
+            e[(*count)++] = n->cell[i];
+            e[(*count)++] = n->cell[i + 1];
+        } else {
+            mnode_entries(n->cell[i + 1], e, count);
+        }
+    }
+}
+
+// the keys and values of m in turn, in the order of their hashes. free it after
+lval** map_entries(lval* m) {
+    lval** e = malloc(sizeof(lval*) * 2 * (m->mcount ? m->mcount : 1));
+    long count = 0;
+    if (m->mroot) { mnode_entries(m->mroot, e, &count); }
+    return e;
+}
+
+/* The reader */
+lval* lval_read_num(mpc_ast_t* ast) {
+    errno = 0;
+    if (strchr(ast->contents, '.')) {
+        double d = strtod(ast->contents, NULL);
+        return errno == ERANGE && isinf(d) ? lval_err("Invalid Number") : lval_float(d);
+    }
+    long x = strtol(ast->contents, NULL, 10);
+    if (errno != ERANGE) { return lval_num(x); }
+    // too big for a long
+    char* digits = ast->contents + (ast->contents[0] == '-');
+    return big_read(digits, strlen(digits), ast->contents[0] == '-');
+}
+
+// remove quotes and unescape the string (convert to encoded characters)
+lval* lval_read_str(mpc_ast_t* ast) {
+    ast->contents[strlen(ast->contents)-1] = '\0';
+    char* unescaped = malloc(strlen(ast->contents+1)+1);
+    strcpy(unescaped, ast->contents+1);
+    unescaped = mpcf_unescape(unescaped);
+    lval* str = lval_str(unescaped);
+    free(unescaped);
+    return str;
+}
+
+// makes room for at least one more element after the last one
+static void lval_reserve(lval* v) {
+    if (v->off + v->count < v->cap) { return; }
+    if (v->owner) {
+        // a view may not write into its owner's buffer, give it its own
+        int cap = v->count < 4 ? 4 : v->count * 2;
+        lval** cell = pool_alloc(sizeof(lval*) * cap);
+        memcpy(cell, v->cell, sizeof(lval*) * v->count);
+        v->cell = cell;
+        v->off = 0;
+        v->cap = cap;
+        v->owner = NULL;
+    } else if (v->off > 0 && v->off >= v->cap / 2) {
+        // at least half the buffer was popped off the front, slide back into it
+        memmove(v->cell - v->off, v->cell, sizeof(lval*) * v->count);
+        v->cell -= v->off;
+        v->off = 0;
+    } else {
+        int cap = v->cap < 4 ? 4 : v->cap * 2;
+        lval** base = pool_realloc(v->cell - v->off, sizeof(lval*) * v->cap, sizeof(lval*) * cap);
+        v->cell = base + v->off;
+        v->cap = cap;
+    }
+}
+
+lval* lval_add(lval* v, lval* x) {
+    lval_reserve(v);
+    v->cell[v->count++] = x;
+    v->hashed = 0;
+    return v;
+}
+/* reader takes an ast from the parser, compares the tags (expr, number, regex etc)
+ * and creates lval array which represents the sexpression. Don't forget
+ * the ast is one giant s-expression.
+ * 
+ * e.g. the line: (+ 2 2) is convert to
+ * root : lval sexpr | count 3 | cell [ addr1, addr2, addr3];
+ * addr1: lval symbol | count undefined | cell undefined | sym +
+ * addr2: lval number | count undefined | cell undefined | num 2
  * addr2: lval number | count undefined | cell undefined | num 2
  * 
  * the root or first lval* is returned
@@ -345,23 +2046,277 @@ lval* lval_read(mpc_ast_t* ast) {
         if (strcmp(ast->children[i]->contents, ")") == 0) { continue; }
         if (strcmp(ast->children[i]->contents, "{") == 0) { continue; }
         if (strcmp(ast->children[i]->contents, "}") == 0) { continue; }
-        if (strcmp(ast->children[i]->contents, "comment") == 0) { continue; }
+        if (strstr(ast->children[i]->tag, "comment")) { continue; }
         if (strcmp(ast->children[i]->tag,  "regex") == 0) { continue; }
         x = lval_add(x, lval_read(ast->children[i]));
     }
+    if (x->type == LVAL_QEXPR) { x = lval_cons(x); }
     return x;
 }
 
 
+/* the reader proper, a single pass over a byte buffer that builds lvals as it
+ * goes without an intermediate tree. it reads the language of the mpc grammar
+ * in main, token for token: a number is tried before a symbol and tokens need
+ * no space between them, so "1-2" is 1 followed by -2. the grammar and
+ * lval_read stay as the reference, build with -DMPC_READER to read through them.
+ *
+ * the reader hands out one top-level form at a time, so a file can be read and
+ * evaluated form by form. lists are built on an explicit stack, not by
+ * recursion, so nesting is only limited by memory.
+*/
+typedef struct {
+    char* name; // file name for error messages
+    char* start;
+    char* pos;
+    char* end;
+    lval** open; // lists still being read, outermost first
+    int open_cap;
+    lval* err; // set once the text does not parse
+} lreader;
+
+static int reader_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static int reader_digit(char c) { return c >= '0' && c <= '9'; }
+
+static int reader_symbol(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || reader_digit(c) || (c && strchr("_+-*/\\=<>!&?", c));
+}
+
+// an error at the reader's position, line and column count from 1 like mpc's
+static lval* reader_err(lreader* r, char* msg) {
+    int line = 1, col = 1;
+    for (char* p = r->start; p < r->pos; p++) {
+        if (*p == '\n') { line++; col = 1; } else { col++; }
+    }
+    if (r->pos == r->end) { return lval_err("%s:%i:%i: error: %s at end of input", r->name, line, col, msg); }
+    return lval_err("%s:%i:%i: error: %s at '%c'", r->name, line, col, msg, *r->pos);
+}
+
+// digits.digits, only the text of the float itself is handed to strtod
+static lval* reader_float(char* begin, char* end) {
+    char buf[64];
+    size_t len = end - begin;
+    char* text = len < sizeof(buf) ? buf : malloc(len + 1);
+    memcpy(text, begin, len);
+    text[len] = '\0';
+    errno = 0;
+    double d = strtod(text, NULL);
+    int overflow = errno == ERANGE && isinf(d);
+    if (text != buf) { free(text); }
+    return overflow ? lval_err("Invalid Number") : lval_float(d);
+}
+
+static lval* reader_num(lreader* r) {
+    char* begin = r->pos;
+    int neg = *r->pos == '-';
+    if (neg) { r->pos++; }
+    long x = 0;
+    int overflow = 0;
+    // accumulate on the negative side, it has room for LONG_MIN
+    while (r->pos < r->end && reader_digit(*r->pos)) {
+        int d = *r->pos++ - '0';
+        if (x < (LONG_MIN + d) / 10) { overflow = 1; } else { x = x * 10 - d; }
+    }
+    if (r->pos + 1 < r->end && *r->pos == '.' && reader_digit(r->pos[1])) {
+        r->pos++;
+        while (r->pos < r->end && reader_digit(*r->pos)) { r->pos++; }
+        return reader_float(begin, r->pos);
+    }
+    if (!neg && x == LONG_MIN) { overflow = 1; }
+    // too big for a long
+    if (overflow) { return big_read(begin + neg, r->pos - begin - neg, neg); }
+    return lval_num(neg ? x : -x);
+}
+
+// unescapes straight from the source into the string's own buffer, like mpcf_unescape
+static lval* reader_str(lreader* r) {
+    char* begin = ++r->pos; // past the opening quote
+    while (r->pos < r->end && *r->pos != '"') {
+        if (*r->pos == '\\' && r->pos + 1 < r->end) { r->pos++; }
+        r->pos++;
+    }
+    if (r->pos == r->end) { return NULL; }
+
+    static const char escapes[] = "abfnrtv\\'\"0";
+    static const char unescaped[] = "\a\b\f\n\r\t\v\\'\"";
+    lval* str = lval_new(LVAL_STR);
+    char* out = str->str = malloc(r->pos - begin + 1);
+    for (char* p = begin; p < r->pos; p++) {
+        char* e = *p == '\\' && p[1] ? strchr(escapes, p[1]) : NULL;
+        if (!e) {
+            *out++ = *p; // an unknown escape keeps its backslash
+        } else if (*++p != '0') {
+            *out++ = unescaped[e - escapes]; // \0 would end the string, it is dropped
+        }
+    }
+    *out = '\0';
+    pool_count(lval_payload(str));
+    r->pos++; // past the closing quote
+    return str;
+}
+
+/* source files are mapped into memory and read in place, the reader never
+ * copies the text. symbols are interned and strings unescaped straight from the
+ * mapping. where there is no mmap the file is read into a buffer instead.
+*/
+char* src_map(char* path, size_t* len) {
+#ifdef _WIN32
+    FILE* f = fopen(path, "rb");
+    if (!f) { return NULL; }
+    size_t cap = 1 << 16;
+    char* src = malloc(cap);
+    size_t n;
+    *len = 0;
+    while ((n = fread(src + *len, 1, cap - *len, f)) > 0) {
+        *len += n;
+        if (*len == cap) { src = realloc(src, cap *= 2); }
+    }
+    fclose(f);
+    return src;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { return NULL; }
+    struct stat st;
+    if (fstat(fd, &st) < 0) { close(fd); return NULL; }
+    *len = st.st_size;
+    // an empty file cannot be mapped, any non NULL pointer will do
+    char* src = *len ? mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+    if (src == MAP_FAILED) { return NULL; }
+    if (*len) { madvise(src, *len, MADV_SEQUENTIAL); }
+    return src;
+#endif
+}
+
+#ifndef LOAD_RELEASE_BYTES
+#define LOAD_RELEASE_BYTES (16 << 20) // text load reads past before handing its pages back
+#endif
+
+// the first done bytes have been read, their pages need not stay in memory
+void src_release(char* src, size_t done) {
+#ifndef _WIN32
+    size_t n = done & ~((size_t) sysconf(_SC_PAGESIZE) - 1);
+    if (n) { madvise(src, n, MADV_DONTNEED); }
+#endif
+}
+
+void src_unmap(char* src, size_t len) {
+#ifdef _WIN32
+    free(src);
+#else
+    if (len) { munmap(src, len); }
+#endif
+}
+
+void reader_init(lreader* r, char* name, char* src, size_t len) {
+    r->name = name;
+    r->start = r->pos = src;
+    r->end = src + len;
+    r->open_cap = 16;
+    r->open = malloc(sizeof(lval*) * r->open_cap);
+    r->err = NULL;
+}
+
+void reader_done(lreader* r) { free(r->open); }
+
+// the next top-level form, NULL at the end of the text or if it does not parse (r->err)
+lval* reader_next(lreader* r) {
+    int depth = 0;
+    while (!r->err) {
+        while (r->pos < r->end && reader_space(*r->pos)) { r->pos++; }
+        if (r->pos == r->end) {
+            if (depth) { r->err = reader_err(r, r->open[depth - 1]->type == LVAL_QEXPR ? "expected '}'" : "expected ')'"); }
+            break;
+        }
+
+        lval* x = NULL; // a whole expression once it has been read
+        char c = *r->pos;
+        if (c == '(' || c == '{') {
+            r->pos++;
+            if (depth == r->open_cap) {
+                r->open_cap *= 2;
+                r->open = realloc(r->open, sizeof(lval*) * r->open_cap);
+            }
+            r->open[depth++] = c == '(' ? lval_sexpr() : lval_qexpr();
+            continue;
+        } else if (c == ')' || c == '}') {
+            int type = c == ')' ? LVAL_SEXPR : LVAL_QEXPR;
+            if (!depth || r->open[depth - 1]->type != type) {
+                r->err = reader_err(r, "unexpected closing bracket");
+                break;
+            }
+            r->pos++;
+            x = r->open[--depth];
+            if (type == LVAL_QEXPR) { x = lval_cons(x); }
+        } else if (c == ';') {
+            while (r->pos < r->end && *r->pos != '\r' && *r->pos != '\n') { r->pos++; } // comment
+            continue;
+        } else if (c == '"') {
+            x = reader_str(r);
+            if (!x) { r->err = reader_err(r, "unterminated string"); break; }
+        } else if (reader_digit(c) || (c == '-' && r->pos + 1 < r->end && reader_digit(r->pos[1]))) {
+            x = reader_num(r);
+        } else if (reader_symbol(c)) {
+            char* begin = r->pos;
+            while (r->pos < r->end && reader_symbol(*r->pos)) { r->pos++; }
+            x = lval_sym_len(begin, r->pos - begin);
+        } else {
+            r->err = reader_err(r, "unexpected character");
+            break;
+        }
+
+        if (depth == 0) { return x; }
+        lval_add(r->open[depth - 1], x);
+    }
+    return NULL;
+}
+
+/* reads every form in the len bytes at src into one S-Expression, the same
+ * shape lval_read gives for the program rule. returns an error if the text
+ * does not parse.
+*/
+lval* lval_read_src(char* name, char* src, size_t len) {
+    lreader r;
+    reader_init(&r, name, src, len);
+    lval* top = lval_sexpr();
+    lval* x;
+    while ((x = reader_next(&r))) { lval_add(top, x); }
+    reader_done(&r);
+    return r.err ? r.err : top;
+}
+
 /* the printer */
 void lval_expr_print(lval* v, char open, char close);
 void lval_print_str(lval* v);
 
+// the shortest form that reads back as the same double, always with a point or exponent
+void lval_print_float(lval* v) {
+    char buf[32];
+    for (int digits = 15; digits <= 17; digits++) {
+        snprintf(buf, sizeof(buf), "%.*g", digits, v->dbl);
+        if (strtod(buf, NULL) == v->dbl) { break; }
+    }
+    if (buf[strspn(buf, "-0123456789")] == '\0') { strcat(buf, ".0"); }
+    fputs(buf, stdout);
+}
+
 void lval_print(lval* v) {
-    switch (v->type) {
+    switch (lval_type(v)) {
         case LVAL_NUM:
-            printf("%li", v->num);
+            printf("%li", lval_long(v));
+            break;
+        case LVAL_FLOAT:
+            lval_print_float(v);
             break;
+        case LVAL_BIG: {
+            char* text = big_text(v);
+            fputs(text, stdout);
+            free(text);
+            break;
+        }
         case LVAL_ERR:
             printf("Error: %s", v->err);
             break;
@@ -377,6 +2332,29 @@ void lval_print(lval* v) {
         case LVAL_QEXPR:
             lval_expr_print(v, '{', '}');
             break;
+        case LVAL_VEC:
+            putchar('[');
+            for (long i = 0; i < v->vcount; i++) {
+                lval_print(vec_get(v, i));
+                if (i != v->vcount - 1) { putchar(' '); }
+            }
+            putchar(']');
+            break;
+        case LVAL_MAP: {
+            lval** e = map_entries(v);
+            printf("#{");
+            for (long i = 0; i < v->mcount; i++) {
+                putchar('{');
+                lval_print(e[2 * i]);
+                putchar(' ');
+                lval_print(e[2 * i + 1]);
+                putchar('}');
+                if (i != v->mcount - 1) { putchar(' '); }
+            }
+            putchar('}');
+            free(e);
+            break;
+        }
         case LVAL_FUNC:
             if (v->builtin) {
                 printf("<builtin>"); 
@@ -419,61 +2397,42 @@ void lval_print_str(lval* v) {
 }
 
 /* Lval utils */
-lval* lval_copy(lval* v) {
-    lval* x = malloc(sizeof(lval)); // create new lval
-    x->type = v->type; // copy type info
-
-    switch (v->type) {
-        /* Copy Functions and Numbers Directly */
-        case LVAL_FUNC:
-            if (v->builtin) {
-                x->builtin = v->builtin;
-            } else {
-                x->builtin = NULL;
-                x->env = lenv_copy(v->env);
-                x->params = lval_copy(v->params);
-                x->body = lval_copy(v->body);
-            }
-            break;
-        case LVAL_NUM:
-            x->num = v->num;
-            break;
-        /* Copy Strings using malloc and strcpy */
-        case LVAL_ERR:
-            x->err = malloc(strlen(v->err) + 1); // this is how you copy a string
-            strcpy(x->err, v->err);
-            break;
-        case LVAL_SYM:
-            x->sym = malloc(strlen(v->sym) + 1);
-            strcpy(x->sym, v->sym);
-            break;
-        case LVAL_STR:
-            x->str = malloc(strlen(v->str) + 1);
-            strcpy(x->str, v->str);
-            break;
-        /* Copy Lists by copying each sub-expression */
-        case LVAL_SEXPR:
-        case LVAL_QEXPR:
-            x->count = v->count;
-            x->cell = malloc(sizeof(lval*) * x->count); // copy the array
-            for (int i = 0; i < x->count; i++) {
-                x->cell[i] = lval_copy(v->cell[i]);
-            }
-            break;
-    }
-    return x;
-}
 
+/* two numbers are equal if their values are, promoted the way the orderings
+ * promote them, so 1, 1.0 and a bignum one are all equal. this holds at any
+ * depth, (== {1} {1.0}) is 1, and for map keys, where 1 and 1.0 are the same
+ * key. lval_hash and the hash consing of lists follow the same rule.
+*/
 int lval_eq(lval* x, lval* y) {
+    if (lval_is_number(x) && lval_is_number(y)) {
+        if (lval_type(x) == LVAL_FLOAT || lval_type(y) == LVAL_FLOAT) { return lval_double(x) == lval_double(y); }
+        if (lval_type(x) == LVAL_BIG || lval_type(y) == LVAL_BIG) { return big_cmp(x, y) == 0; }
+        return lval_long(x) == lval_long(y);
+    }
     /* Different Types are always unequal */
-    if (x->type != y->type) { return 0; }
+    if (lval_type(x) != lval_type(y)) { return 0; }
     /* Compare Based upon type */
-    switch (x->type) {
-        /* Compare Number Value */
-        case LVAL_NUM: return (x->num == y->num);
+    switch (lval_type(x)) {
+        case LVAL_VEC:
+            if (x->vcount != y->vcount) { return 0; }
+            for (long i = 0; i < x->vcount; i++) {
+                if (!lval_eq(vec_get(x, i), vec_get(y, i))) { return 0; }
+            }
+            return 1;
+        case LVAL_MAP: {
+            if (x->mcount != y->mcount) { return 0; }
+            lval** e = map_entries(x);
+            int eq = 1;
+            for (long i = 0; eq && i < x->mcount; i++) {
+                lval* v = map_get(y, e[2 * i]);
+                eq = v && lval_eq(e[2 * i + 1], v);
+            }
+            free(e);
+            return eq;
+        }
         /* Compare String Values */
         case LVAL_ERR: return (strcmp(x->err, y->err) == 0);
-        case LVAL_SYM: return (strcmp(x->sym, y->sym) == 0);
+        case LVAL_SYM: return (x->sym == y->sym); // both interned
         case LVAL_STR: return (strcmp(x->str, y->str) == 0);
         /* If builtin compare, otherwise compare formals and body */
         case LVAL_FUNC:
@@ -486,7 +2445,10 @@ int lval_eq(lval* x, lval* y) {
         /* If list compare every individual element */
         case LVAL_QEXPR:
         case LVAL_SEXPR:
+            if (x == y) { return 1; }
             if (x->count != y->count) { return 0; }
+            if (x->consed && y->consed) { return 0; } // the table holds one of each
+            if (x->hashed && y->hashed && x->hash != y->hash) { return 0; }
             for (int i = 0; i < x->count; i++) {
                 /* If any element not equal then whole list not equal */
                 if (!lval_eq(x->cell[i], y->cell[i])) { return 0; }
@@ -498,68 +2460,76 @@ int lval_eq(lval* x, lval* y) {
     return 0;
 }
 
-lval* lval_call(lenv* env, lval* func, lval* args) {
-    /* If Builtin then simply apply that */
-    if (func->builtin) { return func->builtin(env, args); }
+/* binds args to the formals of the lambda func in a new frame. when every
+ * formal is bound *out is set to the frame and NULL is returned, the caller
+ * then evaluates the body in it. otherwise the result is an error or a
+ * partially applied function.
+*/
+lval* lval_bind(lenv* env, lval* func, lval* args, lenv** out) {
     /* Record Argument Counts */
     int given = args->count;
     int total = func->params->count;
+    /* Bind into a new frame inside the one func closes over */
+    lenv* frame = lenv_new();
+    frame->outer = func->env;
+    int bound = 0; // formals bound so far
     /* While arguments still remain to be processed */
     while (args->count) {
         /* If we've ran out of formal arguments to bind */
-        if (func->params->count == 0) {
-            lval_del(args);
+        if (bound == total) {
             return lval_err("Function passed too many arguments. Got %i, Expected %i.", given, total);
         }
-        lval* sym = lval_pop(func->params, 0); // Pop the first symbol from the formals
+        lval* sym = func->params->cell[bound++]; // Next symbol from the formals
 
         // special case for variable argument list using '&'
-        if (strcmp(sym->sym, "&") == 0) {
-            if (func->params->count != 1) {
-                lval_del(args);
+        if (sym->sym == sym_amp) {
+            if (total - bound != 1) {
                 return lval_err("Function format invalid. Symbol '&' not followed by 1 or more symbols");
             }
-            lval* next_sym = lval_pop(func->params, 0);
-            lenv_put(func->env, next_sym, builtin_list(env, args));
-            lval_del(sym);
-            lval_del(next_sym);
+            lval* next_sym = func->params->cell[bound++];
+            lenv_put(frame, next_sym, builtin_list(env, args));
             break;
         }
 
         lval* val = lval_pop(args, 0); // Pop the next argument from the list
-        lenv_put(func->env, sym, val); // Bind a copy into the function's environment
-        lval_del(sym);
-        lval_del(val);
+        lenv_put(frame, sym, val); // Bind it into the new frame
     }
-    /* Argument list is now bound so can be cleaned up */
-    lval_del(args);
 
     /* If '&' remains in formal list bind to empty list */
-    if (func->params->count > 0 && strcmp(func->params->cell[0]->sym, "&") == 0) {
+    if (bound < total && func->params->cell[bound]->sym == sym_amp) {
         /* Check to ensure that & is not passed invalidly. */
-        if (func->params->count != 2) {
+        if (total - bound != 2) {
             return lval_err("Function format invalid. Symbol '&' not followed by single symbol.");
         }
-        /* Pop and delete '&' symbol */
-        lval_del(lval_pop(func->params, 0));
-        /* Pop next symbol and create empty list */
-        lval* sym = lval_pop(func->params, 0);
-        lval* val = lval_qexpr();
+        /* Bind the symbol after '&' to an empty list */
+        lenv_put(frame, func->params->cell[bound + 1], lval_qexpr());
+        bound += 2;
+    }
 
-        /* Bind to environment and delete */
-        lenv_put(func->env, sym, val);
-        lval_del(sym);
-        lval_del(val);
+    /* If all params have been bound the frame is ready */
+    if (bound == total) {
+        *out = frame;
+        return NULL;
     }
 
-    /* If all params have been bound evaluate */
-    if (func->params->count == 0) {
-        /* Set environment parent to evaluation environment */
-        func->env->parenv = env;
-        return builtin_eval(func->env, lval_add(lval_sexpr(), lval_copy(func->body)));
-    } else {
-        return lval_copy(func); // Otherwise return partially evaluated function
+    /* Otherwise return partially evaluated function holding the remaining formals,
+     * it closes over the frame with the ones bound so far */
+    lval* params = lval_qexpr();
+    for (int i = bound; i < total; i++) {
+        lval_add(params, func->params->cell[i]);
     }
+    lval* partial = lval_lambda(params, func->body);
+    partial->env = frame;
+    return partial;
+}
+
+lval* lval_call(lenv* env, lval* func, lval* args) {
+    /* If Builtin then simply apply that */
+    if (func->builtin) { return func->builtin(env, args); }
+    lenv* frame;
+    lval* result = lval_bind(env, func, args, &frame);
+    if (result) { return result; }
+    return lval_eval_sexpr(frame, func->body);
 }
 
 
@@ -567,30 +2537,33 @@ lval* lval_call(lenv* env, lval* func, lval* args) {
 lval* lval_pop(lval* v, int i) {
     // find the item at i
     lval* x = v->cell[i];
-    // shift memory
-    memmove(&v->cell[i], &v->cell[i + 1], sizeof(lval*) * (v->count - i - 1));
+    if (i == 0) {
+        // the front is dropped by moving past it, no copying
+        v->cell++;
+        v->off++;
+    } else {
+        // shift memory, only lists nobody else can see are popped so this is ours
+        memmove(&v->cell[i], &v->cell[i + 1], sizeof(lval*) * (v->count - i - 1));
+    }
     v->count--; // decrease count of items in the list
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count); // reallocate memory used
-    return x;
-}
-// takes element i in cell array of v, returns it and deletes v
-lval* lval_take(lval* v, int i) {
-    lval* x = lval_pop(v, i);
-    lval_del(v);
+    v->hashed = 0;
     return x;
 }
 
 #define LASSERT(args, cond, fmt, ...) \
     if (!(cond)) { \
-        lval* err = lval_err(fmt, ##__VA_ARGS__); \
-        lval_del(args); \
-        return err; \
+        return lval_err(fmt, ##__VA_ARGS__); \
     }
 
+// a worker must leave the main thread's environments alone, see Parallel functions
+#define LASSERT_UNSHARED(func, args, env) \
+    LASSERT(args, !PAR_SHARED(env), \
+        "Function '%s' cannot change the environment of a parallel call's caller.", func)
+
 #define LASSERT_TYPE(func, args, index, expect) \
-    LASSERT(args, args->cell[index]->type == expect, \
+    LASSERT(args, lval_type(args->cell[index]) == expect, \
         "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
-        func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
+        func, index, ltype_name(lval_type(args->cell[index])), ltype_name(expect))
 
 #define LASSERT_NUM_ARGS(func, args, num) \
     LASSERT(args, args->count == num, \
@@ -602,87 +2575,13 @@ lval* lval_take(lval* v, int i) {
         "Function '%s' passed {} for argument %i.", func, index);
 
 /* Built in operations */
-lval* builtin_op(lenv* env, lval* args, char* op) { // only arithmetic
-    // ensure all args are numbers
-    for (int i = 0; i < args->count; i++) {
-        LASSERT_TYPE(op, args, i, LVAL_NUM);
-    }
-    // pop the first element
-    lval* x = lval_pop(args, 0);
-    // if no args and sub then perform unary negation
-    if ((strcmp(op, "-") == 0) && args->count == 0) {
-        x->num = -x->num;
-    }
-    // while there are still elements remaining
-    while (args->count > 0) {
-        // pop next element
-        lval* y = lval_pop(args, 0);
-        // perform operation
-        if (strcmp(op, "+") == 0 || strcmp(op, "add") == 0) { x->num += y->num; }
-        if (strcmp(op, "-") == 0 || strcmp(op, "sub") == 0) { x->num -= y->num; }
-        if (strcmp(op, "*") == 0 || strcmp(op, "mul") == 0) { x->num *= y->num; }
-        if (strcmp(op, "/") == 0 || strcmp(op, "div") == 0) {
-            if (y->num == 0) {
-                lval_del(x);
-                lval_del(y);
-                x = lval_err("Division By Zero");
-                break;
-            }
-            x->num /= y->num;
-        }
-        if (strcmp(op, "%") == 0 || strcmp(op, "mod") == 0) {
-            if (y->num == 0) {
-                lval_del(x);
-                lval_del(y);
-                x = lval_err("Division By Zero");
-                break;
-            }
-            x->num %= y->num;
-        }
-        lval_del(y); // delete y as we do not need it anymore
-    }
-    lval_del(args); // delete input expression
-    return x;
-}
-
-// comparison ops only work on ints, 0 is falsy, anything else is truthy
-lval* builtin_ord(lenv* env, lval* args, char* op) {
-    LASSERT_NUM_ARGS(op, args, 2);
-    LASSERT_TYPE(op, args, 0, LVAL_NUM);
-    LASSERT_TYPE(op, args, 1, LVAL_NUM);
-
-    int result;
-    if (strcmp(op, ">")  == 0) {
-        result = (args->cell[0]->num >  args->cell[1]->num);
-    }
-    if (strcmp(op, "<")  == 0) {
-        result = (args->cell[0]->num <  args->cell[1]->num);
-    }
-    if (strcmp(op, ">=") == 0) {
-        result = (args->cell[0]->num >= args->cell[1]->num);
-    }
-    if (strcmp(op, "<=") == 0) {
-        result = (args->cell[0]->num <= args->cell[1]->num);
-    }
-    if (strcmp(op, "||") == 0) {
-        result = (args->cell[0]->num || args->cell[1]->num);
-    }
-    if (strcmp(op, "&&") == 0) {
-        result = (args->cell[0]->num && args->cell[1]->num);
-    }
-    lval_del(args);
-    return lval_num(result);
-}
-
 // built in head function to operate on q-expressions aka lists
 lval* builtin_head(lenv* env, lval* a) {
     LASSERT_NUM_ARGS("head", a, 1);
     LASSERT_TYPE("head", a, 0, LVAL_QEXPR);
     LASSERT_NOT_EMPTY("head", a, 0);
 
-    lval* v = lval_take(a, 0);
-    while (v->count > 1) { lval_del(lval_pop(v, 1)); }
-    return v;
+    return lval_add(lval_qexpr(), a->cell[0]->cell[0]);
 }
 // built in tail function to operate on q-expressions aka lists
 lval* builtin_tail(lenv* env, lval* a) {
@@ -692,11 +2591,14 @@ lval* builtin_tail(lenv* env, lval* a) {
     LASSERT_NOT_EMPTY("tail", a, 0);
 
     /* Take first argument */
-    lval* v = lval_take(a, 0);
+    lval* v = a->cell[0];
 
-    /* Delete first element and return */
-    lval_del(lval_pop(v, 0));
-    return v;
+    /* View of everything but the first element, sharing v's buffer */
+    lval* x = lval_qexpr();
+    x->count = v->count - 1;
+    x->cell = v->cell + 1;
+    x->owner = v->owner ? v->owner : v;
+    return x;
 }
 // built in list function, convers sexpressions to list
 lval* builtin_list(lenv* env, lval* a) {
@@ -704,22 +2606,26 @@ lval* builtin_list(lenv* env, lval* a) {
     return a;
 }
 
-lval* builtin_eval(lenv* env, lval* args) {
+// checks the arguments of eval and returns the expression it evaluates, or an error
+lval* eval_expr(lval* args) {
     LASSERT_NUM_ARGS("eval", args, 1);
     LASSERT_TYPE("eval", args, 0, LVAL_QEXPR);
+    return args->cell[0];
+}
 
-    lval* x = lval_take(args, 0);
-    x->type = LVAL_SEXPR;
-    return lval_eval(env, x);
+lval* builtin_eval(lenv* env, lval* args) {
+    lval* expr = eval_expr(args);
+    if (lval_type(expr) == LVAL_ERR) { return expr; }
+    /* Evaluate the list as if it were an S-Expression */
+    return lval_eval_sexpr(env, expr);
 }
 
+// x must be a new list owned by the caller, y is left as it is
 lval* lval_join(lval* x, lval* y) {
     /* For each cell in 'y' add it to 'x' */
-    while (y->count) {
-        x = lval_add(x, lval_pop(y, 0));
+    for (int i = 0; i < y->count; i++) {
+        x = lval_add(x, y->cell[i]);
     }
-    /* Delete the empty 'y' and return 'x' */
-    lval_del(y);
     return x;
 }
 
@@ -728,131 +2634,1027 @@ lval* builtin_join(lenv* env, lval* expr) {
         LASSERT_TYPE("join", expr, i, LVAL_QEXPR);
     }
 
-    lval* x = lval_pop(expr, 0);
+    lval* x = lval_qexpr();
 
-    while (expr->count) {
-        x = lval_join(x, lval_pop(expr, 0));
+    for (int i = 0; i < expr->count; i++) {
+        x = lval_join(x, expr->cell[i]);
     }
 
-    lval_del(expr);
     return x;
 }
 
 // lval* builtin_cons(lval* expr) {}
-// lval* builtin_len(lval* expr) {}
+
+/* List functions
+ * these were lisp functions in the prelude, built from head, tail and join, so
+ * every step copied the list. they keep the prelude's behaviour: the elements
+ * map, filter, foldl, foldr, elem, nth and last look at are evaluated the way
+ * fst evaluates them, other elements are handed on as they are, bad arguments
+ * give the error head, tail or - gave, and given too few arguments they return
+ * a function waiting for the rest like a lambda would.
+*/
+#define LASSERT_LIST_ARITY(func, args, ...) { \
+    char* formals[] = { __VA_ARGS__ }; \
+    lval* early = list_arity(func, args, sizeof(formals) / sizeof(char*), formals); \
+    if (early) { return early; } \
+}
+
+#define LIST_TYPE_ERR(func, v) \
+    lval_err("Function '%s' passed incorrect type for argument 0. Got %s, Expected %s.", \
+        func, ltype_name(lval_type(v)), ltype_name(LVAL_QEXPR))
+
+#define LIST_EMPTY_ERR(func) lval_err("Function '%s' passed {} for argument 0.", func)
+
+// the error (- n 1) gives when n is not a number
+#define LIST_COUNT_ERR(n) \
+    lval_err("Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
+        "-", 0, ltype_name(lval_type(n)), ltype_name(LVAL_NUM))
+
+/* NULL if args has one value for each formal. otherwise an error for too many,
+ * or for too few the lambda \ {rest...} {func formals...} closing over a frame
+ * that binds the ones given. */
+static lval* list_arity(lbuiltin func, lval* args, int total, char** formals) {
+    if (args->count == total) { return NULL; }
+    if (args->count > total) {
+        return lval_err("Function passed too many arguments. Got %i, Expected %i.", args->count, total);
+    }
+    lenv* frame = lenv_new();
+    lval* params = lval_qexpr();
+    lval* body = lval_add(lval_qexpr(), lval_func(func));
+    for (int i = 0; i < total; i++) {
+        lval* sym = lval_sym(formals[i]);
+        if (i < args->count) { lenv_put(frame, sym, args->cell[i]); } else { lval_add(params, sym); }
+        lval_add(body, sym);
+    }
+    lval* partial = lval_lambda(params, body);
+    partial->env = frame;
+    return partial;
+}
+
+// an element as fst gives it
+static lval* list_elem(lenv* env, lval* x) {
+    return lval_eval(env, x);
+}
+
+// calls f with the values in args, which is kept from the collector while f runs
+static lval* list_apply(lenv* env, lval* f, lval* args) {
+    if (lval_type(f) != LVAL_FUNC) {
+        return lval_err("S-Expression starts with incorrect type. Got %s, Expected %s.",
+            ltype_name(lval_type(f)), ltype_name(LVAL_FUNC));
+    }
+    int height = gc_save();
+    gc_root_val(&args);
+    lval* result = lval_call(env, f, args);
+    gc_restore(height);
+    return result;
+}
+
+static lval* list_apply1(lenv* env, lval* f, lval* x) {
+    return list_apply(env, f, lval_add(lval_sexpr(), x));
+}
+
+static lval* list_apply2(lenv* env, lval* f, lval* x, lval* y) {
+    return list_apply(env, f, lval_add(lval_add(lval_sexpr(), x), y));
+}
+
+// elements from i on, sharing l's buffer like tail does
+static lval* list_from(lval* l, int i) {
+    if (i == 0) { return l; }
+    lval* x = lval_qexpr();
+    x->count = l->count - i;
+    x->cell = l->cell + i;
+    x->owner = l->owner ? l->owner : l;
+    return x;
+}
+
+lval* builtin_len(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_len, args, "l");
+    lval* l = args->cell[0];
+    if (lval_type(l) == LVAL_VEC) { return lval_num(l->vcount); }
+    if (lval_type(l) == LVAL_MAP) { return lval_num(l->mcount); }
+    if (lval_type(l) != LVAL_QEXPR) { return LIST_TYPE_ERR("tail", l); }
+    return lval_num(l->count);
+}
+
+// 1 if l has no elements, the test recursion over a list stops on
+lval* builtin_empty(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_empty, args, "l");
+    lval* l = args->cell[0];
+    if (l == lval_nil) { return lval_num(1); }
+    switch (lval_type(l)) {
+        case LVAL_QEXPR: return lval_num(l->count == 0);
+        case LVAL_VEC: return lval_num(l->vcount == 0);
+        case LVAL_MAP: return lval_num(l->mcount == 0);
+        default: return LIST_TYPE_ERR("empty?", l);
+    }
+}
+
+// the nth element of l, counting from 0, as fst gives it
+static lval* list_nth(lenv* env, lval* n, lval* l) {
+    if (lval_type(n) != LVAL_NUM) { return LIST_COUNT_ERR(n); }
+    long i = lval_long(n);
+    if (lval_type(l) != LVAL_QEXPR) { return LIST_TYPE_ERR(i == 0 ? "head" : "tail", l); }
+    if (i == l->count) { return LIST_EMPTY_ERR("head"); }
+    if (i < 0 || i > l->count) { return LIST_EMPTY_ERR("tail"); }
+    return list_elem(env, l->cell[i]);
+}
+
+lval* builtin_nth(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_nth, args, "n", "l");
+    return list_nth(env, args->cell[0], args->cell[1]);
+}
+
+/* fst, snd and trd evaluate the element in the caller's environment, where
+ * select and case clauses and the like were written */
+lval* builtin_fst(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_fst, args, "l");
+    return list_nth(env, lval_num(0), args->cell[0]);
+}
+
+lval* builtin_snd(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_snd, args, "l");
+    return list_nth(env, lval_num(1), args->cell[0]);
+}
+
+lval* builtin_trd(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_trd, args, "l");
+    return list_nth(env, lval_num(2), args->cell[0]);
+}
+
+lval* builtin_last(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_last, args, "l");
+    lval* l = args->cell[0];
+    if (lval_type(l) != LVAL_QEXPR) { return LIST_TYPE_ERR("tail", l); }
+    if (l->count == 0) { return LIST_EMPTY_ERR("tail"); }
+    return list_elem(env, l->cell[l->count - 1]);
+}
+
+lval* builtin_map(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_map, args, "f", "l");
+    lval* f = args->cell[0];
+    lval* l = args->cell[1];
+    if (lval_type(l) != LVAL_QEXPR) { return LIST_TYPE_ERR("head", l); }
+
+    lval* result = lval_qexpr();
+    int height = gc_save();
+    gc_root_val(&result);
+    for (int i = 0; i < l->count; i++) {
+        lval* x = list_elem(env, l->cell[i]);
+        if (lval_type(x) != LVAL_ERR) { x = list_apply1(env, f, x); }
+        if (lval_type(x) == LVAL_ERR) { result = x; break; }
+        lval_add(result, x);
+    }
+    gc_restore(height);
+    return result;
+}
+
+lval* builtin_filter(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_filter, args, "f", "l");
+    lval* f = args->cell[0];
+    lval* l = args->cell[1];
+    if (lval_type(l) != LVAL_QEXPR) { return LIST_TYPE_ERR("head", l); }
+
+    lval* result = lval_qexpr();
+    int height = gc_save();
+    gc_root_val(&result);
+    for (int i = 0; i < l->count; i++) {
+        lval* x = list_elem(env, l->cell[i]);
+        if (lval_type(x) != LVAL_ERR) { x = list_apply1(env, f, x); }
+        if (lval_type(x) != LVAL_ERR && lval_type(x) != LVAL_NUM) {
+            x = lval_err("Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.",
+                "if", 0, ltype_name(lval_type(x)), ltype_name(LVAL_NUM));
+        }
+        if (lval_type(x) == LVAL_ERR) { result = x; break; }
+        // the element is kept as it was written, not as f saw it
+        if (lval_long(x)) { lval_add(result, l->cell[i]); }
+    }
+    gc_restore(height);
+    return result;
+}
+
+lval* builtin_reverse(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_reverse, args, "l");
+    lval* l = args->cell[0];
+    if (lval_type(l) != LVAL_QEXPR) { return LIST_TYPE_ERR("tail", l); }
+    lval* result = lval_qexpr();
+    for (int i = l->count - 1; i >= 0; i--) { lval_add(result, l->cell[i]); }
+    return result;
+}
+
+lval* builtin_foldl(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_foldl, args, "f", "z", "l");
+    lval* f = args->cell[0];
+    lval* l = args->cell[2];
+    if (lval_type(l) == LVAL_QEXPR && l->count == 0) { return args->cell[1]; }
+    if (lval_type(l) != LVAL_QEXPR) { return LIST_TYPE_ERR("head", l); }
+
+    lval* acc = args->cell[1];
+    int height = gc_save();
+    gc_root_val(&acc);
+    for (int i = 0; i < l->count && lval_type(acc) != LVAL_ERR; i++) {
+        lval* x = list_elem(env, l->cell[i]);
+        acc = lval_type(x) == LVAL_ERR ? x : list_apply2(env, f, acc, x);
+    }
+    gc_restore(height);
+    return acc;
+}
+
+lval* builtin_foldr(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_foldr, args, "f", "z", "l");
+    lval* f = args->cell[0];
+    lval* l = args->cell[2];
+    if (lval_type(l) == LVAL_QEXPR && l->count == 0) { return args->cell[1]; }
+    if (lval_type(l) != LVAL_QEXPR) { return LIST_TYPE_ERR("head", l); }
+
+    // every element is evaluated on the way in, f is applied on the way back
+    lval* xs = lval_qexpr();
+    lval* acc = args->cell[1];
+    int height = gc_save();
+    gc_root_val(&xs);
+    gc_root_val(&acc);
+    for (int i = 0; i < l->count && lval_type(acc) != LVAL_ERR; i++) {
+        lval* x = list_elem(env, l->cell[i]);
+        if (lval_type(x) == LVAL_ERR) { acc = x; } else { lval_add(xs, x); }
+    }
+    for (int i = xs->count - 1; i >= 0 && lval_type(acc) != LVAL_ERR; i--) {
+        acc = list_apply2(env, f, xs->cell[i], acc);
+    }
+    gc_restore(height);
+    return acc;
+}
+
+lval* builtin_take(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_take, args, "n", "l");
+    lval* n = args->cell[0];
+    lval* l = args->cell[1];
+    if (lval_type(n) == LVAL_NUM && lval_long(n) == 0) { return lval_qexpr(); }
+    if (lval_type(l) != LVAL_QEXPR) { return LIST_TYPE_ERR("head", l); }
+    if (l->count == 0) { return LIST_EMPTY_ERR("head"); }
+    if (lval_type(n) != LVAL_NUM) { return LIST_COUNT_ERR(n); }
+    long k = lval_long(n);
+    if (k < 0 || k > l->count) { return LIST_EMPTY_ERR("head"); }
+    lval* result = lval_qexpr();
+    for (int i = 0; i < k; i++) { lval_add(result, l->cell[i]); }
+    return result;
+}
+
+lval* builtin_drop(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_drop, args, "n", "l");
+    lval* n = args->cell[0];
+    lval* l = args->cell[1];
+    if (lval_type(n) == LVAL_NUM && lval_long(n) == 0) { return l; }
+    if (lval_type(n) != LVAL_NUM) { return LIST_COUNT_ERR(n); }
+    if (lval_type(l) != LVAL_QEXPR) { return LIST_TYPE_ERR("tail", l); }
+    long k = lval_long(n);
+    if (k < 0 || k > l->count) { return LIST_EMPTY_ERR("tail"); }
+    return list_from(l, k);
+}
+
+lval* builtin_elem(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_elem, args, "x", "l");
+    lval* l = args->cell[1];
+    if (lval_type(l) == LVAL_QEXPR && l->count == 0) { return lval_num(0); }
+    if (lval_type(l) != LVAL_QEXPR) { return LIST_TYPE_ERR("head", l); }
+    for (int i = 0; i < l->count; i++) {
+        lval* x = list_elem(env, l->cell[i]);
+        if (lval_type(x) == LVAL_ERR) { return x; }
+        if (lval_eq(args->cell[0], x)) { return lval_num(1); }
+    }
+    return lval_num(0);
+}
+
+lval* builtin_zip(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_zip, args, "x", "y");
+    lval* x = args->cell[0];
+    lval* y = args->cell[1];
+    if ((lval_type(x) == LVAL_QEXPR && x->count == 0) || (lval_type(y) == LVAL_QEXPR && y->count == 0)) {
+        return lval_qexpr();
+    }
+    if (lval_type(x) != LVAL_QEXPR) { return LIST_TYPE_ERR("head", x); }
+    if (lval_type(y) != LVAL_QEXPR) { return LIST_TYPE_ERR("head", y); }
+    lval* result = lval_qexpr();
+    for (int i = 0; i < x->count && i < y->count; i++) {
+        lval_add(result, lval_add(lval_add(lval_qexpr(), x->cell[i]), y->cell[i]));
+    }
+    return result;
+}
+
+/* vector functions, see Vectors. vec makes a vector of a list's elements,
+ * vget, vset and vpush index, update and extend one without changing it */
+#define LASSERT_INDEX(func, args, v, i) \
+    LASSERT(args, i >= 0 && i < v->vcount, \
+        "Function '%s' passed index %li out of range for Vector of %li.", func, i, v->vcount);
+
+lval* builtin_vec(lenv* env, lval* args) {
+    LASSERT_NUM_ARGS("vec", args, 1);
+    LASSERT_TYPE("vec", args, 0, LVAL_QEXPR);
+    return vec_from(args->cell[0]->cell, args->cell[0]->count);
+}
+
+lval* builtin_vget(lenv* env, lval* args) {
+    LASSERT_NUM_ARGS("vget", args, 2);
+    LASSERT_TYPE("vget", args, 0, LVAL_VEC);
+    LASSERT_TYPE("vget", args, 1, LVAL_NUM);
+    lval* v = args->cell[0];
+    long i = lval_long(args->cell[1]);
+    LASSERT_INDEX("vget", args, v, i);
+    return vec_get(v, i);
+}
+
+lval* builtin_vset(lenv* env, lval* args) {
+    LASSERT_NUM_ARGS("vset", args, 3);
+    LASSERT_TYPE("vset", args, 0, LVAL_VEC);
+    LASSERT_TYPE("vset", args, 1, LVAL_NUM);
+    lval* v = args->cell[0];
+    long i = lval_long(args->cell[1]);
+    LASSERT_INDEX("vset", args, v, i);
+    return vec_set(v, i, args->cell[2]);
+}
+
+lval* builtin_vpush(lenv* env, lval* args) {
+    LASSERT_NUM_ARGS("vpush", args, 2);
+    LASSERT_TYPE("vpush", args, 0, LVAL_VEC);
+    return vec_push(args->cell[0], args->cell[1]);
+}
+
+/* map functions, see Maps. hmap makes a map of a list of {key value} pairs,
+ * the same list lookup searches, hget finds a key's value and hput, hdel and
+ * hkeys work like their vector counterparts */
+lval* builtin_hmap(lenv* env, lval* args) {
+    LASSERT_NUM_ARGS("hmap", args, 1);
+    LASSERT_TYPE("hmap", args, 0, LVAL_QEXPR);
+    lval* l = args->cell[0];
+    lval* m = lval_map(NULL, 0);
+    for (int i = 0; i < l->count; i++) {
+        lval* p = l->cell[i];
+        LASSERT(args, lval_type(p) == LVAL_QEXPR && p->count == 2,
+            "Function 'hmap' passed incorrect entry %i. Got %s, Expected a Q-Expression of key and value.",
+            i, ltype_name(lval_type(p)));
+        m = map_put(m, p->cell[0], p->cell[1]);
+    }
+    return m;
+}
+
+lval* builtin_hget(lenv* env, lval* args) {
+    LASSERT_NUM_ARGS("hget", args, 2);
+    LASSERT_TYPE("hget", args, 0, LVAL_MAP);
+    lval* v = map_get(args->cell[0], args->cell[1]);
+    LASSERT(args, v, "No Element Found");
+    return v;
+}
+
+lval* builtin_hput(lenv* env, lval* args) {
+    LASSERT_NUM_ARGS("hput", args, 3);
+    LASSERT_TYPE("hput", args, 0, LVAL_MAP);
+    return map_put(args->cell[0], args->cell[1], args->cell[2]);
+}
+
+lval* builtin_hdel(lenv* env, lval* args) {
+    LASSERT_NUM_ARGS("hdel", args, 2);
+    LASSERT_TYPE("hdel", args, 0, LVAL_MAP);
+    return map_delete(args->cell[0], args->cell[1]);
+}
+
+lval* builtin_hkeys(lenv* env, lval* args) {
+    LASSERT_NUM_ARGS("hkeys", args, 1);
+    LASSERT_TYPE("hkeys", args, 0, LVAL_MAP);
+    lval* m = args->cell[0];
+    lval** e = map_entries(m);
+    lval* keys = lval_qexpr();
+    for (long i = 0; i < m->mcount; i++) { lval_add(keys, e[2 * i]); }
+    free(e);
+    return keys;
+}
+
+/* Parallel functions
+ * pmap, pfilter and preduce work like map, filter and foldl but hand the
+ * elements out to a pool of worker threads, one per core, started by the first
+ * call. f must not depend on the order the elements are done in, and for
+ * preduce it must be associative: each worker folds the runs of elements it
+ * does and the main thread folds z and the results of the runs in order. an
+ * error stops the workers, the first error in list order among the elements
+ * that were done is returned. a call made from a worker, with fewer than two
+ * elements or with a single core runs like map, filter and foldl.
+ *
+ * a worker allocates from its own heap and collects it by itself. it must not
+ * touch anything of the main thread's, so before the workers start the main
+ * thread marks everything reachable, as a collection would, and leaves the
+ * marks set: a worker's collector stops at marked objects, def and = refuse
+ * to change a marked environment and hashes and programs are not stored on
+ * marked lists. when all workers are done their heaps are joined to the main
+ * heap and the main thread finishes the collection, with the results as roots.
+ *
+ * the list is split into one range of elements per worker. a worker takes
+ * elements off the front of its own range and once it is empty steals the
+ * back half of another worker's range, so a few slow elements do not hold up
+ * the rest.
+*/
+enum { PAR_MAP, PAR_FILTER, PAR_REDUCE };
+
+#ifndef NO_THREADS
+
+#ifndef PAR_WORKERS
+#define PAR_WORKERS 0 // one per core
+#endif
+
+typedef struct {
+    pthread_mutex_t lock;
+    long lo, hi; // elements not yet taken
+} par_range;
+
+typedef struct {
+    int op;
+    lenv* env;
+    lval* f;
+    lval* l;
+    lval** results; // f of each element, for preduce the fold of each run at its first element
+    par_range* ranges; // one per worker
+    atomic_int failed; // an element gave an error, the rest can be left
+} par_job;
+
+typedef struct {
+    lval* vals; // what a worker allocated in the last job, handed to the main thread
+    lval* vals_last;
+    lenv* envs;
+    lenv* envs_last;
+    long objects;
+    long bytes;
+} par_heap;
+
+static struct {
+    int size; // workers, 0 until the pool is started
+    lenv* global;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    long round; // counts the jobs, a worker waits for it to change
+    int busy; // workers still on the current job
+    par_job* job;
+    par_heap* heaps;
+} par = { .lock = PTHREAD_MUTEX_INITIALIZER, .start = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+
+// the next element of worker w's range, stealing from the others once it runs out
+static int par_take(par_job* job, int w, long* i) {
+    par_range* own = &job->ranges[w];
+    for (;;) {
+        int taken = 0;
+        pthread_mutex_lock(&own->lock);
+        if (own->lo < own->hi) {
+            *i = own->lo++;
+            taken = 1;
+        }
+        pthread_mutex_unlock(&own->lock);
+        if (taken) { return 1; }
+
+        long lo = 0, hi = 0;
+        for (int k = 1; k < par.size && lo == hi; k++) {
+            par_range* victim = &job->ranges[(w + k) % par.size];
+            pthread_mutex_lock(&victim->lock);
+            if (victim->lo < victim->hi) {
+                lo = victim->lo + (victim->hi - victim->lo) / 2;
+                hi = victim->hi;
+                victim->hi = lo;
+            }
+            pthread_mutex_unlock(&victim->lock);
+        }
+        if (lo == hi) { return 0; } // every range is empty
+        pthread_mutex_lock(&own->lock);
+        own->lo = lo;
+        own->hi = hi;
+        pthread_mutex_unlock(&own->lock);
+    }
+}
+
+// worker w's part of a job
+static void par_run(par_job* job, int w) {
+    lval* done = lval_qexpr(); // everything put in results, for this worker's collections
+    lval* acc = NULL; // preduce, the fold of the run of elements from start
+    long start = 0, next = -1;
+    int height = gc_save();
+    gc_root_val(&done);
+    gc_root_val(&acc);
+    long i;
+    while (!atomic_load(&job->failed) && par_take(job, w, &i)) {
+        lval* x = list_elem(job->env, job->l->cell[i]);
+        if (job->op == PAR_REDUCE) {
+            if (i != next) {
+                // a new run, the last one is done
+                if (acc) {
+                    lval_add(done, acc);
+                    job->results[start] = acc;
+                }
+                start = i;
+            } else if (lval_type(x) != LVAL_ERR) {
+                x = list_apply2(job->env, job->f, acc, x);
+            }
+            acc = x;
+            next = i + 1;
+        } else {
+            if (lval_type(x) != LVAL_ERR) { x = list_apply1(job->env, job->f, x); }
+            if (job->op == PAR_FILTER && lval_type(x) != LVAL_ERR && lval_type(x) != LVAL_NUM) {
+                x = lval_err("Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.",
+                    "if", 0, ltype_name(lval_type(x)), ltype_name(LVAL_NUM));
+            }
+            lval_add(done, x);
+            job->results[i] = x;
+        }
+        if (lval_type(x) == LVAL_ERR) { atomic_store(&job->failed, 1); }
+    }
+    if (acc) { job->results[start] = acc; }
+    gc_restore(height);
+}
+
+static void* par_worker_main(void* arg) {
+    int w = (int) (intptr_t) arg;
+    par_worker = 1;
+    long round = 0;
+    pthread_mutex_lock(&par.lock);
+    for (;;) {
+        while (par.round == round) { pthread_cond_wait(&par.start, &par.lock); }
+        round = par.round;
+        par_job* job = par.job;
+        gc.global = par.global;
+        pthread_mutex_unlock(&par.lock);
+
+        par_run(job, w);
+        code_clear();
+        // the heap goes to the main thread, which finishes its collection
+        par_heap* h = &par.heaps[w];
+        h->vals = gc.vals;
+        h->envs = gc.envs;
+        h->vals_last = NULL;
+        h->envs_last = NULL;
+        for (lval* v = gc.vals; v; v = v->gc_next) { h->vals_last = v; }
+        for (lenv* e = gc.envs; e; e = e->gc_next) { h->envs_last = e; }
+        h->objects = gc.objects;
+        h->bytes = pool.bytes;
+        pool.bytes = 0;
+        gc.vals = NULL;
+        gc.envs = NULL;
+        gc.objects = 0;
+        gc.threshold = GC_MIN_THRESHOLD;
+
+        pthread_mutex_lock(&par.lock);
+        if (--par.busy == 0) { pthread_cond_signal(&par.done); }
+    }
+    return NULL;
+}
+
+// workers in the pool, started on first use
+static int par_start(void) {
+    if (par.size) { return par.size; }
+    long n = PAR_WORKERS ? PAR_WORKERS : sysconf(_SC_NPROCESSORS_ONLN);
+    par.size = 1;
+    if (n < 2) { return par.size; }
+    par.heaps = calloc(n, sizeof(par_heap));
+    for (int w = 0; w < n; w++) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, par_worker_main, (void*) (intptr_t) w) != 0) { break; }
+        pthread_detach(t);
+        par.size = w + 1;
+    }
+    return par.size;
+}
+
+// runs a job on the pool, results has room for every element of l
+static void par_call(int op, lenv* env, lval* f, lval* l, lval** results) {
+    par_job job = { op, env, f, l, results, malloc(sizeof(par_range) * par.size), 0 };
+    for (int w = 0; w < par.size; w++) {
+        pthread_mutex_init(&job.ranges[w].lock, NULL);
+        job.ranges[w].lo = l->count * w / par.size;
+        job.ranges[w].hi = l->count * (w + 1) / par.size;
+    }
+
+    clock_t start = clock();
+    gc_mark();
+    clock_t marking = clock() - start;
+
+    pthread_mutex_lock(&par.lock);
+    par.job = &job;
+    par.global = gc.global;
+    par.busy = par.size;
+    par.round++;
+    par_running = 1;
+    pthread_cond_broadcast(&par.start);
+    while (par.busy) { pthread_cond_wait(&par.done, &par.lock); }
+    par_running = 0;
+    pthread_mutex_unlock(&par.lock);
+
+    for (int w = 0; w < par.size; w++) {
+        par_heap* h = &par.heaps[w];
+        if (h->vals) {
+            h->vals_last->gc_next = gc.vals;
+            gc.vals = h->vals;
+        }
+        if (h->envs) {
+            h->envs_last->gc_next = gc.envs;
+            gc.envs = h->envs;
+        }
+        gc.objects += h->objects;
+        pool_count(h->bytes);
+        pthread_mutex_destroy(&job.ranges[w].lock);
+    }
+    free(job.ranges);
+    for (long i = 0; i < l->count; i++) { gc_mark_val(results[i]); }
+    gc_trace();
+    gc_finish(clock() - marking);
+}
+
+#endif
+
+// the parallel functions, see above. NULL if the call is left to map, filter or foldl
+static lval* par_apply(int op, lenv* env, lval* f, lval* z, lval* l) {
+#ifdef NO_THREADS
+    return NULL;
+#else
+    if (par_worker || lval_type(l) != LVAL_QEXPR || l->count < 2 || par_start() < 2) { return NULL; }
+    lval** results = calloc(l->count, sizeof(lval*));
+    par_call(op, env, f, l, results);
+
+    lval* result = lval_qexpr();
+    for (long i = 0; i < l->count; i++) {
+        lval* x = results[i];
+        if (!x) { continue; }
+        if (lval_type(x) == LVAL_ERR) { result = x; break; }
+        if (op == PAR_MAP) { lval_add(result, x); }
+        if (op == PAR_FILTER && lval_long(x)) { lval_add(result, l->cell[i]); }
+        if (op == PAR_REDUCE) { lval_add(result, x); } // the runs, folded below
+    }
+    free(results);
+    if (op != PAR_REDUCE || lval_type(result) == LVAL_ERR) { return result; }
+
+    lval* acc = z;
+    int height = gc_save();
+    gc_root_val(&result);
+    gc_root_val(&acc);
+    for (int i = 0; i < result->count && lval_type(acc) != LVAL_ERR; i++) {
+        acc = list_apply2(env, f, acc, result->cell[i]);
+    }
+    gc_restore(height);
+    return acc;
+#endif
+}
+
+lval* builtin_pmap(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_pmap, args, "f", "l");
+    lval* result = par_apply(PAR_MAP, env, args->cell[0], NULL, args->cell[1]);
+    return result ? result : builtin_map(env, args);
+}
+
+lval* builtin_pfilter(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_pfilter, args, "f", "l");
+    lval* result = par_apply(PAR_FILTER, env, args->cell[0], NULL, args->cell[1]);
+    return result ? result : builtin_filter(env, args);
+}
+
+lval* builtin_preduce(lenv* env, lval* args) {
+    LASSERT_LIST_ARITY(builtin_preduce, args, "f", "z", "l");
+    lval* result = par_apply(PAR_REDUCE, env, args->cell[0], args->cell[1], args->cell[2]);
+    return result ? result : builtin_foldl(env, args);
+}
+
+/* arithmetic, one builtin per operator. the arguments are checked once, then
+ * the common (op a b) is worked out straight from the two cells and longer
+ * calls fold left over the cells, the result is accumulated unboxed. if any
+ * argument is a float the fold is done in doubles. integers are folded as
+ * longs with overflow checks, a bignum argument or an overflow hands the whole
+ * fold to big_fold. */
+#define LASSERT_NUMBERS(op, args) \
+    for (int i = 0; i < args->count; i++) { \
+        LASSERT(args, lval_is_number(args->cell[i]), \
+            "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.", \
+            op, i, ltype_name(lval_type(args->cell[i])), ltype_name(LVAL_NUM)); \
+    }
+
+// LVAL_FLOAT if any argument is a float, otherwise LVAL_BIG if any is a bignum, otherwise LVAL_NUM
+static int lval_kind(lval* args) {
+    int kind = LVAL_NUM;
+    for (int i = 0; i < args->count; i++) {
+        int t = lval_type(args->cell[i]);
+        if (t == LVAL_FLOAT) { return LVAL_FLOAT; }
+        if (t == LVAL_BIG) { kind = LVAL_BIG; }
+    }
+    return kind;
+}
 
 lval* builtin_add(lenv* env, lval* args) {
-    return builtin_op(env, args, "+");
+    LASSERT_NUMBERS("+", args);
+    lval** a = args->cell;
+    int kind = lval_kind(args);
+    if (kind == LVAL_FLOAT) {
+        double x = lval_double(a[0]);
+        for (int i = 1; i < args->count; i++) { x += lval_double(a[i]); }
+        return lval_float(x);
+    }
+    if (kind == LVAL_NUM) {
+        long x;
+        if (args->count == 2 && !long_add(lval_long(a[0]), lval_long(a[1]), &x)) { return lval_num(x); }
+        x = lval_long(a[0]);
+        int i = 1;
+        while (i < args->count && !long_add(x, lval_long(a[i]), &x)) { i++; }
+        if (i == args->count) { return lval_num(x); }
+    }
+    return big_fold('+', a, args->count);
 }
 
 lval* builtin_sub(lenv* env, lval* args) {
-    return builtin_op(env, args, "-");
+    LASSERT_NUMBERS("-", args);
+    lval** a = args->cell;
+    int kind = lval_kind(args);
+    if (kind == LVAL_FLOAT) {
+        double x = lval_double(a[0]);
+        if (args->count == 1) { return lval_float(-x); }
+        for (int i = 1; i < args->count; i++) { x -= lval_double(a[i]); }
+        return lval_float(x);
+    }
+    if (kind == LVAL_NUM) {
+        long x;
+        if (args->count == 2 && !long_sub(lval_long(a[0]), lval_long(a[1]), &x)) { return lval_num(x); }
+        // no args after the first is unary negation
+        if (args->count == 1 && !long_sub(0, lval_long(a[0]), &x)) { return lval_num(x); }
+        x = lval_long(a[0]);
+        int i = 1;
+        while (i < args->count && !long_sub(x, lval_long(a[i]), &x)) { i++; }
+        if (i == args->count && args->count > 1) { return lval_num(x); }
+    }
+    return big_fold('-', a, args->count);
 }
 
 lval* builtin_mul(lenv* env, lval* args) {
-    return builtin_op(env, args, "*");
+    LASSERT_NUMBERS("*", args);
+    lval** a = args->cell;
+    int kind = lval_kind(args);
+    if (kind == LVAL_FLOAT) {
+        double x = lval_double(a[0]);
+        for (int i = 1; i < args->count; i++) { x *= lval_double(a[i]); }
+        return lval_float(x);
+    }
+    if (kind == LVAL_NUM) {
+        long x;
+        if (args->count == 2 && !long_mul(lval_long(a[0]), lval_long(a[1]), &x)) { return lval_num(x); }
+        x = lval_long(a[0]);
+        int i = 1;
+        while (i < args->count && !long_mul(x, lval_long(a[i]), &x)) { i++; }
+        if (i == args->count) { return lval_num(x); }
+    }
+    return big_fold('*', a, args->count);
 }
 
+// integers divide to an integer, as soon as a float is involved the division is exact
 lval* builtin_div(lenv* env, lval* args) {
-    return builtin_op(env, args, "/");
+    LASSERT_NUMBERS("/", args);
+    lval** a = args->cell;
+    int kind = lval_kind(args);
+    if (kind == LVAL_FLOAT) {
+        double x = lval_double(a[0]);
+        for (int i = 1; i < args->count; i++) {
+            double y = lval_double(a[i]);
+            if (y == 0) { return lval_err("Division By Zero"); }
+            x /= y;
+        }
+        return lval_float(x);
+    }
+    if (kind == LVAL_NUM) {
+        long x = lval_long(a[0]);
+        int i = 1;
+        for (; i < args->count; i++) {
+            long y = lval_long(a[i]);
+            if (y == 0) { return lval_err("Division By Zero"); }
+            if (y == -1 && x == LONG_MIN) { break; } // the one quotient that overflows
+            x /= y;
+        }
+        if (i == args->count) { return lval_num(x); }
+    }
+    return big_fold('/', a, args->count);
 }
 
 lval* builtin_mod(lenv* env, lval* args) {
-    return builtin_op(env, args, "%");
+    LASSERT_NUMBERS("%", args);
+    lval** a = args->cell;
+    int kind = lval_kind(args);
+    if (kind == LVAL_FLOAT) {
+        double x = lval_double(a[0]);
+        for (int i = 1; i < args->count; i++) {
+            double y = lval_double(a[i]);
+            if (y == 0) { return lval_err("Division By Zero"); }
+            x = fmod(x, y);
+        }
+        return lval_float(x);
+    }
+    if (kind == LVAL_NUM) {
+        long x = lval_long(a[0]);
+        for (int i = 1; i < args->count; i++) {
+            long y = lval_long(a[i]);
+            if (y == 0) { return lval_err("Division By Zero"); }
+            x = y == -1 ? 0 : x % y; // LONG_MIN % -1 traps
+        }
+        return lval_num(x);
+    }
+    return big_fold('%', a, args->count);
+}
+
+/* comparison ops, 0 is falsy, anything else is truthy. the orderings take
+ * any numbers, the logical ones only ints */
+#define LASSERT_ORD(op, args) \
+    LASSERT_NUM_ARGS(op, args, 2); \
+    LASSERT_NUMBERS(op, args);
+
+#define LASSERT_LOGIC(op, args) \
+    LASSERT_NUM_ARGS(op, args, 2); \
+    LASSERT_TYPE(op, args, 0, LVAL_NUM); \
+    LASSERT_TYPE(op, args, 1, LVAL_NUM);
+
+// compares the two arguments with the C operator op, in doubles if either is a float
+#define LVAL_ORD(args, op) { \
+    lval* x = args->cell[0]; \
+    lval* y = args->cell[1]; \
+    switch (lval_kind(args)) { \
+        case LVAL_FLOAT: return lval_num(lval_double(x) op lval_double(y)); \
+        case LVAL_BIG: return lval_num(big_cmp(x, y) op 0); \
+        default: return lval_num(lval_long(x) op lval_long(y)); \
+    } \
 }
 
-// comparison ops
 lval* builtin_gt(lenv* env, lval* args) {
-    return builtin_ord(env, args, ">");
+    LASSERT_ORD(">", args);
+    LVAL_ORD(args, >);
 }
 
 lval* builtin_lt(lenv* env, lval* args) {
-    return builtin_ord(env, args, "<");
+    LASSERT_ORD("<", args);
+    LVAL_ORD(args, <);
 }
 
 lval* builtin_ge(lenv* env, lval* args) {
-    return builtin_ord(env, args, ">=");
+    LASSERT_ORD(">=", args);
+    LVAL_ORD(args, >=);
 }
 
 lval* builtin_le(lenv* env, lval* args) {
-    return builtin_ord(env, args, "<=");
+    LASSERT_ORD("<=", args);
+    LVAL_ORD(args, <=);
 }
 
-lval* builtin_or(lenv* env, lval* args) {
-    return builtin_ord(env, args, "||");
+lval* builtin_or(lenv* env, lval* args) {
+    LASSERT_LOGIC("||", args);
+    return lval_num(lval_long(args->cell[0]) || lval_long(args->cell[1]));
+}
+
+lval* builtin_and(lenv* env, lval* args) {
+    LASSERT_LOGIC("&&", args);
+    return lval_num(lval_long(args->cell[0]) && lval_long(args->cell[1]));
+}
+
+lval* builtin_not(lenv* env, lval* args) {
+    char* op = "!";
+    LASSERT_NUM_ARGS(op, args, 1);
+    LASSERT_TYPE(op, args, 0, LVAL_NUM);
+
+    int result = !(lval_long(args->cell[0]));
+    return lval_num(result);
+}
+
+lval* builtin_eq(lenv* env, lval* args) {
+    LASSERT_NUM_ARGS("==", args, 2);
+    return lval_num(lval_eq(args->cell[0], args->cell[1]));
+}
+
+lval* builtin_ne(lenv* env, lval* args) {
+    LASSERT_NUM_ARGS("!=", args, 2);
+    return lval_num(!lval_eq(args->cell[0], args->cell[1]));
+}
+
+// checks the arguments of if and returns the branch it evaluates, or an error
+lval* if_branch(lval* args) {
+    LASSERT_NUM_ARGS("if", args, 3);
+    LASSERT_TYPE("if", args, 0, LVAL_NUM);
+    LASSERT_TYPE("if", args, 1, LVAL_QEXPR);
+    LASSERT_TYPE("if", args, 2, LVAL_QEXPR);
+
+    /* If condition is true evaluate first expression, otherwise the second */
+    return lval_long(args->cell[0]) ? args->cell[1] : args->cell[2];
+}
+
+lval* builtin_if(lenv* env, lval* args) {
+    lval* branch = if_branch(args);
+    if (lval_type(branch) == LVAL_ERR) { return branch; }
+    return lval_eval_sexpr(env, branch);
+}
+
+/* select, case and let evaluate code written by their caller, so they are
+ * builtins: a lambda would evaluate it in its own frame, where the caller's
+ * variables cannot be seen. like if they end by evaluating one expression in
+ * place of the call. a pick function returns the value of the call, or NULL
+ * with *next set to the list to evaluate as an S-Expression and *env to the
+ * environment to evaluate it in.
+*/
+typedef lval* (*lpick)(lenv** env, lval* args, lval** next);
+
+// the value of x in env, or NULL with *next set to x when x needs evaluating as a list
+static lval* pick_expr(lenv* env, lval* x, lval** next) {
+    if (lval_type(x) == LVAL_SEXPR) {
+        *next = x;
+        return NULL;
+    }
+    return lval_eval(env, x);
 }
 
-lval* builtin_and(lenv* env, lval* args) {
-    return builtin_ord(env, args, "&&");
+// the condition or key of a clause {x value}, with the errors fst gave
+static lval* clause_head(lenv* env, lval* c) {
+    if (lval_type(c) != LVAL_QEXPR) { return LIST_TYPE_ERR("head", c); }
+    if (c->count == 0) { return LIST_EMPTY_ERR("head"); }
+    return lval_eval(env, c->cell[0]);
 }
 
-lval* builtin_not(lenv* env, lval* args) {
-    char* op = "!";
-    LASSERT_NUM_ARGS(op, args, 1);
-    LASSERT_TYPE(op, args, 0, LVAL_NUM);
-
-    int result = !(args->cell[0]->num);
-    lval_del(args);
-    return lval_num(result);
+// the value of a clause, with the error snd gave
+static lval* clause_body(lenv* env, lval* c, lval** next) {
+    if (c->count < 2) { return LIST_EMPTY_ERR("head"); }
+    return pick_expr(env, c->cell[1], next);
 }
 
-lval* builtin_cmp(lenv* env, lval* args, char* op) {
-    LASSERT_NUM_ARGS(op, args, 2);
-    int result;
-    if (strcmp(op, "==") == 0) {
-        result =  lval_eq(args->cell[0], args->cell[1]);
-    }
-    if (strcmp(op, "!=") == 0) {
-        result = !lval_eq(args->cell[0], args->cell[1]);
+// the value of the first clause {condition value} whose condition is not 0
+lval* select_pick(lenv** env, lval* args, lval** next) {
+    for (int i = 0; i < args->count; i++) {
+        lval* x = clause_head(*env, args->cell[i]);
+        if (lval_type(x) == LVAL_ERR) { return x; }
+        LASSERT(args, lval_type(x) == LVAL_NUM,
+            "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.",
+            "if", 0, ltype_name(lval_type(x)), ltype_name(LVAL_NUM));
+        if (lval_long(x)) { return clause_body(*env, args->cell[i], next); }
     }
-    lval_del(args);
-    return lval_num(result);
+    return lval_err("No Selection Found");
 }
 
-lval* builtin_eq(lenv* env, lval* args) {
-    return builtin_cmp(env, args, "==");
+// the value of the first clause {key value} whose key is equal to the first argument
+lval* case_pick(lenv** env, lval* args, lval** next) {
+    LASSERT(args, args->count > 0,
+        "Function '%s' passed incorrect number of arguments. Got %i, Expected %s.", "case", 0, "1 or more");
+    for (int i = 1; i < args->count; i++) {
+        lval* x = clause_head(*env, args->cell[i]);
+        if (lval_type(x) == LVAL_ERR) { return x; }
+        if (lval_eq(args->cell[0], x)) { return clause_body(*env, args->cell[i], next); }
+    }
+    return lval_err("No Case Found");
 }
 
-lval* builtin_ne(lenv* env, lval* args) {
-    return builtin_cmp(env, args, "!=");
+// the list runs in a new frame inside the caller's, so what it binds with '=' stays in it
+lval* let_pick(lenv** env, lval* args, lval** next) {
+    LASSERT_NUM_ARGS("let", args, 1);
+    LASSERT_TYPE("let", args, 0, LVAL_QEXPR);
+    lenv* frame = lenv_new();
+    frame->outer = lenv_closure(*env);
+    *env = frame;
+    *next = args->cell[0];
+    return NULL;
 }
 
-lval* builtin_if(lenv* env, lval* args) {
-    LASSERT_NUM_ARGS("if", args, 3);
-    LASSERT_TYPE("if", args, 0, LVAL_NUM);
-    LASSERT_TYPE("if", args, 1, LVAL_QEXPR);
-    LASSERT_TYPE("if", args, 2, LVAL_QEXPR);
+// evaluates what pick chose, for calls that do not come from the evaluator
+static lval* pick_eval(lpick pick, lenv* env, lval* args) {
+    lval* next;
+    lval* x = pick(&env, args, &next);
+    return x ? x : lval_eval_sexpr(env, next);
+}
 
-    /* Mark Both Expressions as evaluable */
-    lval* x;
-    args->cell[1]->type = LVAL_SEXPR;
-    args->cell[2]->type = LVAL_SEXPR;
+lval* builtin_select(lenv* env, lval* args) { return pick_eval(select_pick, env, args); }
+lval* builtin_case(lenv* env, lval* args) { return pick_eval(case_pick, env, args); }
+lval* builtin_let(lenv* env, lval* args) { return pick_eval(let_pick, env, args); }
 
-    if (args->cell[0]->num) {
-        x = lval_eval(env, lval_pop(args, 1)); // If condition is true evaluate first expression
-    } else {
-        x = lval_eval(env, lval_pop(args, 2)); // Otherwise evaluate second expression
-    }
-    lval_del(args); // Delete argument list and return
-    return x;
+// the pick function of a builtin, NULL for the others
+lpick builtin_pick(lbuiltin func) {
+    if (func == builtin_select) { return select_pick; }
+    if (func == builtin_case) { return case_pick; }
+    if (func == builtin_let) { return let_pick; }
+    return NULL;
 }
 
+/* every builtin under the name it was registered with, so an image can store a
+ * builtin by name and find the function again in the next process */
+#define BUILTINS_MAX 256
+
+static struct {
+    char* name; // interned
+    lbuiltin func;
+} builtins[BUILTINS_MAX];
+static int builtins_count;
+
 // register builtin functions into the environment
 void lenv_add_builtin(lenv* env, char* name, lbuiltin func) {
-    lval* key = lval_sym(name);
-    lval* val = lval_func(func);
-    lenv_put(env, key, val);
-    lval_del(key);
-    lval_del(val);
+    lval* sym = lval_sym(name);
+    if (builtins_count < BUILTINS_MAX) {
+        builtins[builtins_count].name = sym->sym;
+        builtins[builtins_count++].func = func;
+    }
+    lenv_put(env, sym, lval_func(func));
 }
 
-lval* builtin_var(lenv* env, lval* args, char* func) {
+// def binds with lenv_def and = with lenv_put, func is the name for errors
+lval* builtin_var(lenv* env, lval* args, char* func, void (*bind)(lenv*, lval*, lval*)) {
     LASSERT_TYPE(func, args, 0, LVAL_QEXPR);
     lval* symbols = args->cell[0]; // first arg is symbol list
     for (int i = 0; i < symbols->count; i++) { // ensure all symbols are actually symbols
-        LASSERT(args, symbols->cell[i]->type == LVAL_SYM,
+        LASSERT(args, lval_type(symbols->cell[i]) == LVAL_SYM,
             "Function '%s' cannot define non-symbol. Received %s, Expected %s.", func,
-            ltype_name(symbols->cell[i]->type), ltype_name(LVAL_SYM));
+            ltype_name(lval_type(symbols->cell[i])), ltype_name(LVAL_SYM));
     }
 
     /* Check correct number of symbols and values */
@@ -860,29 +3662,22 @@ lval* builtin_var(lenv* env, lval* args, char* func) {
         "Function '%s' passed too many arguments for symbols. "
         "Got %i, Expected %i.", func, symbols->count, args->count-1);
 
+    LASSERT_UNSHARED(func, args, bind == lenv_def ? gc.global : env);
+
     /* Assign copies of values to symbols */
     for (int i = 0; i < symbols->count; i++) {
-        /* If 'def' define in globally. If 'put' define in locally */
-        if (strcmp(func, "def") == 0) {
-            lenv_def(env, symbols->cell[i], args->cell[i+1]);
-        }
-
-        if (strcmp(func, "=")   == 0) {
-            lenv_put(env, symbols->cell[i], args->cell[i+1]);
-        }
-        
+        bind(env, symbols->cell[i], args->cell[i+1]);
     }
 
-    lval_del(args);
     return lval_sexpr();
 }
 
 lval* builtin_def(lenv* env, lval* args) {
-    return builtin_var(env, args, "def");   
+    return builtin_var(env, args, "def", lenv_def);
 }
 
 lval* builtin_put(lenv* env, lval* args) {
-    return builtin_var(env, args, "=");   
+    return builtin_var(env, args, "=", lenv_put);
 }
 
 lval* builtin_lambda(lenv* env, lval* args) {
@@ -894,7 +3689,7 @@ lval* builtin_lambda(lenv* env, lval* args) {
     char* expected_type = ltype_name(LVAL_SYM);
     // check the list of symbols is all symbols
     for (int i = 0; i < args->cell[0]->count; i++) { // args->cell[0] is the list of symbols
-        int arg_type = args->cell[0]->cell[i]->type;
+        int arg_type = lval_type(args->cell[0]->cell[i]);
         LASSERT(args, (arg_type == LVAL_SYM),
             "Cannot define non-symbol. Received %s, Expected %s.",
             ltype_name(arg_type), expected_type);
@@ -902,8 +3697,34 @@ lval* builtin_lambda(lenv* env, lval* args) {
 
     lval* params = lval_pop(args, 0);
     lval* body = lval_pop(args, 0);
-    lval_del(args); // wish i had a garbage collector
-    return lval_lambda(params, body);
+    lval* lambda = lval_lambda(params, body);
+    lambda->env = lenv_closure(env);
+    return lambda;
+}
+
+// (fun {name formals...} body) defines a function globally, like def and \ together
+lval* builtin_fun(lenv* env, lval* args) {
+    LASSERT_NUM_ARGS("fun", args, 2);
+    LASSERT_TYPE("fun", args, 0, LVAL_QEXPR);
+    LASSERT_TYPE("fun", args, 1, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY("fun", args, 0);
+    LASSERT_UNSHARED("fun", args, gc.global);
+
+    lval* names = args->cell[0];
+    for (int i = 0; i < names->count; i++) {
+        int arg_type = lval_type(names->cell[i]);
+        LASSERT(args, (arg_type == LVAL_SYM),
+            "Cannot define non-symbol. Received %s, Expected %s.",
+            ltype_name(arg_type), ltype_name(LVAL_SYM));
+    }
+
+    lval* params = lval_qexpr();
+    for (int i = 1; i < names->count; i++) { lval_add(params, names->cell[i]); }
+    // the body is written where fun is called, so it closes over that frame
+    lval* lambda = lval_lambda(params, args->cell[1]);
+    lambda->env = lenv_closure(env);
+    lenv_def(env, names->cell[0], lambda);
+    return lval_sexpr();
 }
 
 lval* builtin_print(lenv* env, lval* args) {
@@ -913,7 +3734,6 @@ lval* builtin_print(lenv* env, lval* args) {
         putchar(' ');
     }
     putchar('\n');
-    lval_del(args);
     return lval_sexpr();
 }
 
@@ -921,18 +3741,473 @@ lval* builtin_error(lenv* env, lval* args) {
     LASSERT_NUM_ARGS("error", args, 1);
     LASSERT_TYPE("error", args, 0, LVAL_STR);
     /* Construct Error from first argument */
-    lval* err = lval_err(args->cell[0]->str);
-    lval_del(args);
-    return err;
+    return lval_err(args->cell[0]->str);
+}
+
+static lval* gc_stat(char* name, long value) {
+    return lval_add(lval_add(lval_qexpr(), lval_sym(name)), lval_num(value));
+}
+
+/* collector statistics as a list of {name value} pairs. it takes no input but
+ * like any zero argument function it is called with a dummy argument: (gc-stats ())
+ * heap-objects and heap-bytes are counted as objects are made and freed, so they
+ * are the heap as it is now, garbage not yet collected included */
+lval* builtin_gc_stats(lenv* env, lval* args) {
+    lval* stats = lval_qexpr();
+    lval_add(stats, gc_stat("collections", gc.collections));
+    lval_add(stats, gc_stat("pause-total-us", (long) (gc.pause_total * 1e6)));
+    lval_add(stats, gc_stat("pause-max-us", (long) (gc.pause_max * 1e6)));
+    lval_add(stats, gc_stat("heap-objects", gc.objects));
+    lval_add(stats, gc_stat("heap-bytes", pool.bytes));
+    lval_add(stats, gc_stat("threshold", gc.threshold));
+    return stats;
+}
+
+/* Images
+ * save-image writes every binding of the global environment to a file, and
+ * loading that file puts them all back, so a program can start from an image
+ * of the prelude instead of reading and evaluating it again. values are written
+ * depth first, each lval and lenv the first time it is reached and as its
+ * number after that, so sharing and cycles through closures survive. builtins
+ * are written by name and bytecode is not written at all, it is compiled again
+ * on first use. an image only makes sense to the build that wrote it.
+*/
+#define IMG_MAGIC "HLIMAGE2"
+#define IMG_MAGIC_LEN 8
+
+enum { IMG_NUM = 'n', IMG_FLOAT = 'd', IMG_BIG = 'i', IMG_VEC = '[', IMG_MAP = '#', IMG_ERR = 'e', IMG_SYM = 's', IMG_STR = 't', IMG_BUILTIN = 'b',
+    IMG_LAMBDA = 'f', IMG_SEXPR = '(', IMG_QEXPR = '{', IMG_REF = 'r',
+    IMG_NULL = '0', IMG_GLOBAL = 'g', IMG_ENV = 'v' };
+
+typedef struct {
+    FILE* f;
+    void** keys; // objects already written, open addressing
+    int* ids;
+    int count;
+    int cap; // always a power of two
+} img_writer;
+
+static void img_insert(img_writer* w, void* p, int id) {
+    unsigned long i = sym_ptr_hash(p) & (w->cap - 1);
+    while (w->keys[i]) { i = (i + 1) & (w->cap - 1); }
+    w->keys[i] = p;
+    w->ids[i] = id;
+}
+
+// the number of an object already written, or -1 after numbering it
+static int img_seen(img_writer* w, void* p) {
+    unsigned long i = sym_ptr_hash(p) & (w->cap - 1);
+    while (w->keys[i]) {
+        if (w->keys[i] == p) { return w->ids[i]; }
+        i = (i + 1) & (w->cap - 1);
+    }
+    if ((w->count + 1) * 2 > w->cap) {
+        img_writer grown = { w->f, calloc(w->cap * 2, sizeof(void*)), malloc(sizeof(int) * w->cap * 2), w->count, w->cap * 2 };
+        for (int j = 0; j < w->cap; j++) {
+            if (w->keys[j]) { img_insert(&grown, w->keys[j], w->ids[j]); }
+        }
+        free(w->keys);
+        free(w->ids);
+        *w = grown;
+    }
+    img_insert(w, p, w->count++);
+    return -1;
+}
+
+static void img_long(img_writer* w, int64_t x) { fwrite(&x, sizeof(x), 1, w->f); }
+
+static void img_name(img_writer* w, char* s) {
+    img_long(w, strlen(s));
+    fputs(s, w->f);
+}
+
+static void img_text(img_writer* w, char tag, char* s) {
+    fputc(tag, w->f);
+    img_name(w, s);
+}
+
+static void img_write_env(img_writer* w, lenv* e);
+
+static void img_write_val(img_writer* w, lval* v) {
+    if (lval_type(v) == LVAL_NUM) {
+        fputc(IMG_NUM, w->f);
+        img_long(w, lval_long(v));
+        return;
+    }
+    if (v->type == LVAL_FLOAT) {
+        fputc(IMG_FLOAT, w->f);
+        fwrite(&v->dbl, sizeof(double), 1, w->f);
+        return;
+    }
+    if (v->type == LVAL_BIG) {
+        char* text = big_text(v);
+        img_text(w, IMG_BIG, text);
+        free(text);
+        return;
+    }
+    int id = img_seen(w, v);
+    if (id >= 0) {
+        fputc(IMG_REF, w->f);
+        img_long(w, id);
+        return;
+    }
+    switch (v->type) {
+        case LVAL_ERR: img_text(w, IMG_ERR, v->err); break;
+        case LVAL_SYM: img_text(w, IMG_SYM, v->sym); break;
+        case LVAL_STR: img_text(w, IMG_STR, v->str); break;
+        case LVAL_FUNC:
+            if (v->builtin) {
+                char* name = ""; // found by no name, so the image will not load
+                for (int i = 0; i < builtins_count; i++) {
+                    if (builtins[i].func == v->builtin) { name = builtins[i].name; }
+                }
+                img_text(w, IMG_BUILTIN, name);
+            } else {
+                fputc(IMG_LAMBDA, w->f);
+                img_write_env(w, v->env);
+                img_write_val(w, v->params);
+                img_write_val(w, v->body);
+            }
+            break;
+        case LVAL_VEC:
+            fputc(IMG_VEC, w->f);
+            img_long(w, v->vcount);
+            for (long i = 0; i < v->vcount; i++) { img_write_val(w, vec_get(v, i)); }
+            break;
+        case LVAL_MAP: {
+            lval** e = map_entries(v);
+            fputc(IMG_MAP, w->f);
+            img_long(w, 2 * v->mcount);
+            for (long i = 0; i < 2 * v->mcount; i++) { img_write_val(w, e[i]); }
+            free(e);
+            break;
+        }
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            fputc(v->type == LVAL_SEXPR ? IMG_SEXPR : IMG_QEXPR, w->f);
+            img_long(w, v->count);
+            for (int i = 0; i < v->count; i++) { img_write_val(w, v->cell[i]); }
+            break;
+    }
+}
+
+static void img_write_env(img_writer* w, lenv* e) {
+    if (!e || e == gc.global) {
+        fputc(e ? IMG_GLOBAL : IMG_NULL, w->f);
+        return;
+    }
+    int id = img_seen(w, e);
+    if (id >= 0) {
+        fputc(IMG_REF, w->f);
+        img_long(w, id);
+        return;
+    }
+    fputc(IMG_ENV, w->f);
+    img_write_env(w, e->outer);
+    img_long(w, e->arity);
+    if (e->arity) {
+        img_write_val(w, e->names);
+        for (int i = 0; i < e->arity; i++) { img_write_val(w, e->slots[i]); }
+    }
+    img_long(w, e->count);
+    for (int i = 0; i < e->cap; i++) {
+        if (e->symbols[i]) {
+            img_name(w, e->symbols[i]);
+            img_write_val(w, e->values[i]);
+        }
+    }
+}
+
+/* reading an image back. nothing in it is trusted, a bad tag or a length
+ * running past the end stops the read. no collection can start while an image
+ * is read, so the values made so far need no rooting. */
+typedef struct {
+    void* p;
+    int is_env;
+} img_obj;
+
+typedef struct {
+    char* pos;
+    char* end;
+    img_obj* objs; // by number, in the order they were written
+    int count;
+    int cap;
+    int bad;
+} img_reader;
+
+static int64_t img_read_long(img_reader* r) {
+    int64_t x = 0;
+    if (r->end - r->pos < (long) sizeof(x)) { r->bad = 1; return 0; }
+    memcpy(&x, r->pos, sizeof(x));
+    r->pos += sizeof(x);
+    return x;
+}
+
+static int img_read_tag(img_reader* r) {
+    if (r->pos == r->end) { r->bad = 1; return 0; }
+    return *r->pos++;
+}
+
+// the bytes of a text field, which are not terminated in the image
+static char* img_read_text(img_reader* r, int64_t* len) {
+    *len = img_read_long(r);
+    if (r->bad || *len < 0 || *len > r->end - r->pos) { r->bad = 1; return NULL; }
+    char* s = r->pos;
+    r->pos += *len;
+    return s;
+}
+
+// an interned name, written without a tag
+static char* img_read_name(img_reader* r) {
+    int64_t len;
+    char* s = img_read_text(r, &len);
+    return s ? sym_intern_len(s, len) : NULL;
+}
+
+static void img_number_obj(img_reader* r, void* p, int is_env) {
+    if (r->count == r->cap) {
+        r->cap = r->cap ? r->cap * 2 : 256;
+        r->objs = realloc(r->objs, sizeof(img_obj) * r->cap);
+    }
+    r->objs[r->count].p = p;
+    r->objs[r->count++].is_env = is_env;
+}
+
+static void* img_read_ref(img_reader* r, int is_env) {
+    int64_t id = img_read_long(r);
+    if (r->bad || id < 0 || id >= r->count || r->objs[id].is_env != is_env) { r->bad = 1; return NULL; }
+    return r->objs[id].p;
+}
+
+static lenv* img_read_env(img_reader* r);
+
+static lval* img_read_val(img_reader* r) {
+    int tag = img_read_tag(r);
+    if (r->bad) { return NULL; }
+    if (tag == IMG_NUM) { return lval_num(img_read_long(r)); }
+    if (tag == IMG_FLOAT) {
+        int64_t bits = img_read_long(r); // the same eight bytes
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        return lval_float(d);
+    }
+    if (tag == IMG_REF) { return img_read_ref(r, 0); }
+
+    int64_t len;
+    char* s;
+    lval* v;
+    switch (tag) {
+        case IMG_BIG: {
+            if (!(s = img_read_text(r, &len))) { return NULL; }
+            int neg = len && s[0] == '-';
+            if (len == neg || (int64_t) strspn(s + neg, "0123456789") < len - neg) { r->bad = 1; return NULL; }
+            return big_read(s + neg, len - neg, neg);
+        }
+        case IMG_ERR:
+        case IMG_STR:
+            if (!(s = img_read_text(r, &len))) { return NULL; }
+            v = lval_new(tag == IMG_ERR ? LVAL_ERR : LVAL_STR);
+            char* text = malloc(len + 1);
+            memcpy(text, s, len);
+            text[len] = '\0';
+            if (tag == IMG_ERR) { v->err = text; } else { v->str = text; }
+            pool_count(lval_payload(v));
+            img_number_obj(r, v, 0);
+            return v;
+        case IMG_SYM:
+            if (!(s = img_read_text(r, &len))) { return NULL; }
+            v = lval_sym_len(s, len);
+            img_number_obj(r, v, 0);
+            return v;
+        case IMG_BUILTIN: {
+            char* name = img_read_name(r);
+            for (int i = 0; i < builtins_count; i++) {
+                if (builtins[i].name == name) {
+                    v = lval_func(builtins[i].func);
+                    img_number_obj(r, v, 0);
+                    return v;
+                }
+            }
+            r->bad = 1;
+            return NULL;
+        }
+        case IMG_LAMBDA:
+            v = lval_new(LVAL_FUNC);
+            v->builtin = NULL;
+            v->env = NULL;
+            v->params = v->body = NULL;
+            img_number_obj(r, v, 0);
+            v->env = img_read_env(r);
+            v->params = img_read_val(r);
+            v->body = img_read_val(r);
+            if (r->bad) { return NULL; }
+            if (lval_type(v->params) != LVAL_QEXPR || lval_type(v->body) != LVAL_QEXPR) { r->bad = 1; return NULL; }
+            for (int i = 0; i < v->params->count; i++) {
+                if (lval_type(v->params->cell[i]) != LVAL_SYM) { r->bad = 1; return NULL; }
+                sym_mark_local(v->params->cell[i]->sym);
+            }
+            return v;
+        case IMG_SEXPR:
+        case IMG_QEXPR:
+        case IMG_VEC:
+        case IMG_MAP: {
+            // a vector or map is read as a list first, it cannot contain itself
+            v = tag == IMG_SEXPR ? lval_sexpr() : lval_qexpr();
+            int id = r->count;
+            img_number_obj(r, v, 0);
+            len = img_read_long(r);
+            // every element takes at least one byte, which bounds a bad count
+            if (r->bad || len < 0 || len > r->end - r->pos) { r->bad = 1; return NULL; }
+            for (int64_t i = 0; i < len; i++) {
+                lval* x = img_read_val(r);
+                if (r->bad) { return NULL; }
+                lval_add(v, x);
+            }
+            if (tag == IMG_VEC) { r->objs[id].p = v = vec_from(v->cell, v->count); }
+            if (tag == IMG_QEXPR && v->count == 0) { r->objs[id].p = v = lval_nil; }
+            if (tag == IMG_MAP) {
+                if (v->count % 2) { r->bad = 1; return NULL; }
+                lval* m = lval_map(NULL, 0);
+                for (int i = 0; i < v->count; i += 2) { m = map_put(m, v->cell[i], v->cell[i + 1]); }
+                r->objs[id].p = v = m;
+            }
+            return v;
+        }
+    }
+    r->bad = 1;
+    return NULL;
+}
+
+static lenv* img_read_env(img_reader* r) {
+    int tag = img_read_tag(r);
+    if (r->bad) { return NULL; }
+    if (tag == IMG_NULL) { return NULL; }
+    if (tag == IMG_GLOBAL) { return gc.global; }
+    if (tag == IMG_REF) { return img_read_ref(r, 1); }
+    if (tag != IMG_ENV) { r->bad = 1; return NULL; }
+
+    lenv* e = lenv_new();
+    img_number_obj(r, e, 1);
+    e->outer = img_read_env(r);
+    int64_t arity = img_read_long(r);
+    if (r->bad || arity < 0 || arity > r->end - r->pos) { r->bad = 1; return NULL; }
+    if (arity) {
+        e->names = img_read_val(r);
+        if (r->bad || lval_type(e->names) != LVAL_QEXPR || e->names->count != arity) { r->bad = 1; return NULL; }
+        for (int i = 0; i < arity; i++) {
+            if (lval_type(e->names->cell[i]) != LVAL_SYM) { r->bad = 1; return NULL; }
+            sym_mark_local(e->names->cell[i]->sym);
+        }
+        e->slots = pool_alloc(sizeof(lval*) * arity);
+        e->arity = arity;
+        for (int i = 0; i < arity; i++) {
+            e->slots[i] = img_read_val(r);
+            if (r->bad) { return NULL; }
+        }
+    }
+    int64_t count = img_read_long(r);
+    if (r->bad || count < 0 || count > r->end - r->pos) { r->bad = 1; return NULL; }
+    for (int64_t i = 0; i < count; i++) {
+        char* name = img_read_name(r);
+        lval* x = img_read_val(r);
+        if (r->bad) { return NULL; }
+        lenv_put(e, lval_sym(name), x);
+    }
+    return e;
+}
+
+int image_is(char* src, size_t len) {
+    return len >= IMG_MAGIC_LEN && memcmp(src, IMG_MAGIC, IMG_MAGIC_LEN) == 0;
+}
+
+// binds everything in the image at src in the global environment
+lval* image_restore(char* name, char* src, size_t len) {
+    img_reader r = { src + IMG_MAGIC_LEN, src + len, NULL, 0, 0, 0 };
+    int64_t count = img_read_long(&r);
+    for (int64_t i = 0; i < count && !r.bad; i++) {
+        char* name = img_read_name(&r);
+        lval* x = img_read_val(&r);
+        if (!r.bad) { lenv_put(gc.global, lval_sym(name), x); }
+    }
+    free(r.objs);
+    if (r.bad) { return lval_err("Could not load Image %s: image is corrupt", name); }
+    return lval_sexpr();
+}
+
+// (save-image "file") writes the global environment to file
+lval* builtin_save_image(lenv* env, lval* args) {
+    LASSERT_NUM_ARGS("save-image", args, 1);
+    LASSERT_TYPE("save-image", args, 0, LVAL_STR);
+
+    img_writer w = { fopen(args->cell[0]->str, "wb"), calloc(256, sizeof(void*)), malloc(sizeof(int) * 256), 0, 256 };
+    if (!w.f) {
+        free(w.keys);
+        free(w.ids);
+        return lval_err("Could not save Image %s: %s", args->cell[0]->str, strerror(errno));
+    }
+    lenv* global = gc.global;
+    fwrite(IMG_MAGIC, 1, IMG_MAGIC_LEN, w.f);
+    img_long(&w, global->count);
+    for (int i = 0; i < global->cap; i++) {
+        if (global->symbols[i]) {
+            img_name(&w, global->symbols[i]);
+            img_write_val(&w, global->values[i]);
+        }
+    }
+    int failed = ferror(w.f);
+    failed |= fclose(w.f) != 0;
+    free(w.keys);
+    free(w.ids);
+    if (failed) { return lval_err("Could not save Image %s: %s", args->cell[0]->str, strerror(errno)); }
+    return lval_sexpr();
 }
 
 void lenv_add_builtins(lenv* env) {
+    /* Atoms */
+    lval_nil = lval_cons(lval_qexpr());
+    gc_root_val(&lval_nil);
+    lenv_put(env, lval_sym("nil"), lval_nil);
+
     /* List Functions */
     lenv_add_builtin(env, "list", builtin_list);
     lenv_add_builtin(env, "head", builtin_head);
     lenv_add_builtin(env, "tail", builtin_tail);
     lenv_add_builtin(env, "eval", builtin_eval);
     lenv_add_builtin(env, "join", builtin_join);
+    lenv_add_builtin(env, "len", builtin_len);
+    lenv_add_builtin(env, "empty?", builtin_empty);
+    lenv_add_builtin(env, "nth", builtin_nth);
+    lenv_add_builtin(env, "fst", builtin_fst);
+    lenv_add_builtin(env, "snd", builtin_snd);
+    lenv_add_builtin(env, "trd", builtin_trd);
+    lenv_add_builtin(env, "last", builtin_last);
+    lenv_add_builtin(env, "map", builtin_map);
+    lenv_add_builtin(env, "filter", builtin_filter);
+    lenv_add_builtin(env, "reverse", builtin_reverse);
+    lenv_add_builtin(env, "foldl", builtin_foldl);
+    lenv_add_builtin(env, "foldr", builtin_foldr);
+    lenv_add_builtin(env, "take", builtin_take);
+    lenv_add_builtin(env, "drop", builtin_drop);
+    lenv_add_builtin(env, "elem", builtin_elem);
+    lenv_add_builtin(env, "zip", builtin_zip);
+
+    /* Vector Functions */
+    lenv_add_builtin(env, "vec", builtin_vec);
+    lenv_add_builtin(env, "vget", builtin_vget);
+    lenv_add_builtin(env, "vset", builtin_vset);
+    lenv_add_builtin(env, "vpush", builtin_vpush);
+
+    /* Map Functions */
+    lenv_add_builtin(env, "hmap", builtin_hmap);
+    lenv_add_builtin(env, "hget", builtin_hget);
+    lenv_add_builtin(env, "hput", builtin_hput);
+    lenv_add_builtin(env, "hdel", builtin_hdel);
+    lenv_add_builtin(env, "hkeys", builtin_hkeys);
+
+    /* Parallel Functions */
+    lenv_add_builtin(env, "pmap", builtin_pmap);
+    lenv_add_builtin(env, "pfilter", builtin_pfilter);
+    lenv_add_builtin(env, "preduce", builtin_preduce);
 
     /* Mathematical Functions */
     lenv_add_builtin(env, "+", builtin_add);
@@ -945,9 +4220,13 @@ void lenv_add_builtins(lenv* env) {
     lenv_add_builtin(env, "def", builtin_def);
     lenv_add_builtin(env, "=", builtin_put);
     lenv_add_builtin(env, "\\", builtin_lambda);
+    lenv_add_builtin(env, "fun", builtin_fun);
 
     /* Comparison Functions */
     lenv_add_builtin(env, "if", builtin_if);
+    lenv_add_builtin(env, "select", builtin_select);
+    lenv_add_builtin(env, "case", builtin_case);
+    lenv_add_builtin(env, "let", builtin_let);
     lenv_add_builtin(env, "==", builtin_eq);
     lenv_add_builtin(env, "!=", builtin_ne);
     lenv_add_builtin(env, ">",  builtin_gt);
@@ -962,6 +4241,10 @@ void lenv_add_builtins(lenv* env) {
     lenv_add_builtin(env, "load",  builtin_load);
     lenv_add_builtin(env, "error", builtin_error);
     lenv_add_builtin(env, "print", builtin_print);
+
+    /* Interpreter Functions */
+    lenv_add_builtin(env, "gc-stats", builtin_gc_stats);
+    lenv_add_builtin(env, "save-image", builtin_save_image);
 }
 
 /* Evaluation
@@ -969,32 +4252,398 @@ void lenv_add_builtins(lenv* env) {
  * (+ 2 2) = lval sexpr [lval sym, lval num, lval num]
  * 
 */
-lval* lval_eval_sexpr(lenv* env, lval* v) {
-    // evaluate children if there are any
-    for (int i = 0; i < v->count; i++) {
-        v->cell[i] = lval_eval(env, v->cell[i]);
+/* the tree walker, evaluates v in env straight from the list. if, eval, select,
+ * case, let and lambdas in tail position do not recurse: v and env are replaced by the branch
+ * or body and the loop goes round again, so a chain of tail calls runs in
+ * constant C stack however long it is.
+*/
+lval* lval_walk_sexpr(lenv* env, lval* v) {
+    // everything this frame holds is on the eval stack before a collection can run
+    int height = gc_save();
+    lval* args = NULL;
+    lval* func = NULL;
+    gc_root_env(&env);
+    gc_root_val(&v);
+    gc_root_val(&args);
+    gc_root_val(&func);
+
+    lval* result = NULL;
+    while (!result) {
+        gc_maybe_collect();
+
+        // evaluate children into a new list, v itself may be shared and is not modified
+        args = lval_sexpr();
+        for (int i = 0; i < v->count; i++) {
+            lval_add(args, lval_eval(env, v->cell[i]));
+        }
+
+        // error checking, here the only error will be an invalid number
+        for (int i = 0; i < args->count && !result; i++) {
+            if (lval_type(args->cell[i]) == LVAL_ERR) { result = args->cell[i]; }
+        }
+
+        if (result) {
+            // an argument failed, return its error
+        } else if (args->count == 0) {
+            result = args; // empty expression
+        } else if (args->count == 1) {
+            result = args->cell[0]; // single expression
+        } else {
+            // ensure first element is a function
+            func = lval_pop(args, 0);
+            if (lval_type(func) != LVAL_FUNC) {
+                result = lval_err("S-Expression starts with incorrect type. Got %s, Expected %s.",
+                    ltype_name(lval_type(func)), ltype_name(LVAL_FUNC));
+            } else if (func->builtin == builtin_if || func->builtin == builtin_eval) {
+                // evaluate the chosen expression in place of this one
+                lval* next = func->builtin == builtin_if ? if_branch(args) : eval_expr(args);
+                if (lval_type(next) == LVAL_ERR) { result = next; } else { v = next; }
+            } else if (func->builtin && builtin_pick(func->builtin)) {
+                // select, case and let likewise, once they have chosen
+                result = builtin_pick(func->builtin)(&env, args, &v);
+            } else if (func->builtin) {
+                // call builtin with operator
+                result = func->builtin(env, args);
+            } else {
+                // evaluate the body in the bound frame in place of this expression
+                lenv* frame;
+                result = lval_bind(env, func, args, &frame);
+                if (!result) {
+                    env = frame;
+                    v = func->body;
+                }
+            }
+        }
     }
-    // error checking, here the only error will be an invalid number
+
+    gc_restore(height);
+    return result;
+}
+
+static void lcode_emit(lcode* c, int x) { c->code[c->count++] = x; }
+
+static int lcode_const(lcode* c, lval* x) {
+    c->consts[c->consts_count] = x;
+    return c->consts_count++;
+}
+
+// upper bound on the room the program of v needs, so it fits in one block
+static void lcode_size(lval* v, int* code, int* consts) {
     for (int i = 0; i < v->count; i++) {
-        if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
-    }
-    // empty expression
-    if (v->count == 0) { return v; }
-    // single expression
-    if (v->count == 1) { return lval_take(v, 0); }
-    // ensure first element is a symbol
-    lval* func = lval_pop(v, 0);
-    if (func->type != LVAL_FUNC) {
-        lval* err = lval_err("S-Expression starts with incorrect type. Got %s, Expected %s.",
-            ltype_name(func->type), ltype_name(LVAL_FUNC));
-        lval_del(func);
-        lval_del(v);
-        return err;
+        if (lval_type(v->cell[i]) == LVAL_SEXPR) {
+            lcode_size(v->cell[i], code, consts);
+        } else {
+            *code += 4;
+            (*consts)++;
+        }
     }
-    // call builtin with operator
-    lval* result = lval_call(env, func, v);
-    lval_del(func);
-    return result;
+    *code += 2; // the call
+}
+
+static void compile_sexpr(lcode* c, lval* v, int tail);
+
+// code leaving the value of x on the stack
+static void compile_expr(lcode* c, lval* x) {
+    switch (lval_type(x)) {
+        case LVAL_SYM: {
+            // a formal of the frame or of a frame it closes over is read straight from its slot
+            for (int d = 0; d < c->depth; d++) {
+                int f = lenv_formal(c->scope[d], x->sym);
+                if (f < 0) { continue; }
+                if (d == 0) {
+                    lcode_emit(c, OP_LOCAL);
+                } else {
+                    lcode_emit(c, OP_OUTER);
+                    lcode_emit(c, d);
+                }
+                lcode_emit(c, f);
+                lcode_emit(c, lcode_const(c, x));
+                return;
+            }
+            lcode_emit(c, OP_LOOKUP);
+            lcode_emit(c, lcode_const(c, x));
+            lcode_emit(c, 0); // slot of the symbol in the frame, filled in on first use
+            break;
+        }
+        case LVAL_SEXPR: compile_sexpr(c, x, 0); break;
+        default:
+            lcode_emit(c, OP_CONST);
+            lcode_emit(c, lcode_const(c, x));
+    }
+}
+
+// the children go on the stack in order, then the call, same rules as the walker
+static void compile_sexpr(lcode* c, lval* v, int tail) {
+    if (v->count == 0) { lcode_emit(c, OP_EMPTY); return; } // empty expression
+    if (v->count == 1) { compile_expr(c, v->cell[0]); return; } // single expression
+    for (int i = 0; i < v->count; i++) { compile_expr(c, v->cell[i]); }
+    lcode_emit(c, tail ? OP_TAILCALL : OP_CALL);
+    lcode_emit(c, v->count);
+}
+
+/* the program of v, compiled the first time v is run. formals are resolved
+ * against env, the frame it is first run in, and the frames env closes over.
+ * later runs in frames of another shape look them up by name.
+*/
+static lcode* code_get(lval* v, lenv* env) {
+    lcode* c = code_find(v);
+    if (c) { return c; }
+    int depth = 0;
+    for (lenv* e = env; e && e->names; e = e->outer) { depth++; }
+    int code = 1, consts = 0; // the return
+    lcode_size(v, &code, &consts);
+    c = malloc(sizeof(lcode) + sizeof(lval*) * (consts + depth) + sizeof(int) * code);
+    c->consts = (lval**) (c + 1);
+    c->scope = c->consts + consts;
+    c->code = (int*) (c->scope + depth);
+    c->count = c->consts_count = 0;
+    c->depth = depth;
+    for (lenv* e = env; depth--; e = e->outer) { *c->scope++ = e->names; }
+    c->scope -= c->depth;
+    compile_sexpr(c, v, 1);
+    lcode_emit(c, OP_RETURN);
+    code_insert(v, c);
+    return c;
+}
+
+static void vm_push(lval* v) {
+    if (vm.sp == vm.stack_cap) {
+        vm.stack_cap = vm.stack_cap ? vm.stack_cap * 2 : 1024;
+        vm.stack = realloc(vm.stack, sizeof(lval*) * vm.stack_cap);
+    }
+    vm.stack[vm.sp++] = v;
+}
+
+// true if env and its enclosing frames have the formals c was resolved against
+static int lcode_fits(lcode* c, lenv* env) {
+    for (int d = 0; d < c->depth; d++, env = env->outer) {
+        if (!env || env->names != c->scope[d]) { return 0; }
+    }
+    return 1;
+}
+
+static void vm_enter(lenv* env, lval* expr) {
+    if (vm.fp == vm.frames_cap) {
+        vm.frames_cap = vm.frames_cap ? vm.frames_cap * 2 : 256;
+        vm.frames = realloc(vm.frames, sizeof(vm_frame) * vm.frames_cap);
+    }
+    vm_frame* f = &vm.frames[vm.fp++];
+    f->expr = expr;
+    f->code = code_get(expr, env);
+    f->pc = 0;
+    f->env = env;
+    f->lexical = lcode_fits(f->code, env);
+    f->base = vm.sp;
+}
+
+// the frame runs expr next, used for calls in tail position
+static void vm_replace(vm_frame* f, lenv* env, lval* expr) {
+    vm.sp = f->base;
+    f->expr = expr;
+    f->code = code_get(expr, env);
+    f->pc = 0;
+    f->env = env;
+    f->lexical = lcode_fits(f->code, env);
+}
+
+// the values stack[from..sp) as a new argument list
+static lval* vm_args(int from) {
+    lval* args = lval_sexpr();
+    args->count = args->cap = vm.sp - from;
+    args->cell = pool_alloc(sizeof(lval*) * args->cap);
+    memcpy(args->cell, &vm.stack[from], sizeof(lval*) * args->count);
+    return args;
+}
+
+// a frame for func when the stack holds exactly one value per formal, or NULL
+static lenv* vm_bind(lval* func, int from) {
+    lval* params = func->params;
+    if (vm.sp - from != params->count) { return NULL; }
+    for (int i = 0; i < params->count; i++) {
+        if (params->cell[i]->sym == sym_amp) { return NULL; }
+    }
+    // the arguments become the frame's slots as they are
+    lenv* frame = lenv_new();
+    frame->outer = func->env;
+    frame->names = params;
+    frame->arity = params->count;
+    frame->slots = pool_alloc(sizeof(lval*) * params->count);
+    memcpy(frame->slots, &vm.stack[from], sizeof(lval*) * params->count);
+    return frame;
+}
+
+/* looks sym up from env. a symbol never bound outside the global environment
+ * goes straight to the global table. *slot remembers where the symbol was last
+ * found, in the global table or in env's own.
+*/
+static lval* vm_lookup(lenv* env, lval* sym, int* slot) {
+    lenv* e = sym_is_local(sym->sym) ? env : gc.global;
+    if (*slot < e->cap && e->symbols[*slot] == sym->sym) { return e->values[*slot]; }
+    if (e->count) {
+        int i = lenv_slot(e, sym->sym);
+        if (e->symbols[i]) {
+            *slot = i;
+            return e->values[i];
+        }
+    }
+    return lenv_get(e, sym);
+}
+
+/* evaluates v in env on the bytecode machine. a call to a lambda, or to if or
+ * eval with valid arguments, or to select, case or let once they have chosen,
+ * pushes a frame for the body or branch instead of recursing, or reuses the
+ * current one in tail position. builtins that evaluate code themselves come
+ * back in here, one level up.
+*/
+lval* vm_run(lenv* env, lval* v) {
+    int floor = vm.fp;
+    vm_enter(env, v);
+
+    for (;;) {
+        // frames may move when the machine grows, so look the frame up each time
+        vm_frame* f = &vm.frames[vm.fp - 1];
+        int* code = f->code->code;
+        switch (code[f->pc++]) {
+            case OP_CONST:
+                vm_push(f->code->consts[code[f->pc++]]);
+                break;
+
+            case OP_LOCAL: {
+                lenv* e = f->env;
+                int i = code[f->pc];
+                lval* sym = f->code->consts[code[f->pc + 1]];
+                f->pc += 2;
+                vm_push(f->lexical ? e->slots[i] : lenv_get(e, sym));
+                break;
+            }
+
+            case OP_OUTER: {
+                int d = code[f->pc];
+                int i = code[f->pc + 1];
+                lval* sym = f->code->consts[code[f->pc + 2]];
+                f->pc += 3;
+                // a name bound with '=' on the way out hides the formal
+                lenv* e = f->lexical ? f->env : NULL;
+                for (int j = 0; j < d && e; j++) { e = e->count ? NULL : e->outer; }
+                vm_push(e ? e->slots[i] : lenv_get(f->env, sym));
+                break;
+            }
+
+            case OP_LOOKUP: {
+                lval* sym = f->code->consts[code[f->pc]];
+                int* slot = &code[f->pc + 1];
+                f->pc += 2;
+                vm_push(vm_lookup(f->env, sym, slot));
+                break;
+            }
+
+            case OP_EMPTY:
+                vm_push(lval_sexpr());
+                break;
+
+            case OP_CALL:
+            case OP_TAILCALL: {
+                int tail = code[f->pc - 1] == OP_TAILCALL;
+                int n = code[f->pc++];
+                int from = vm.sp - n;
+                gc_maybe_collect(); // everything live is on the machine's stacks
+
+                // an argument failed, return its error
+                lval* result = NULL;
+                for (int i = from; i < vm.sp && !result; i++) {
+                    if (lval_type(vm.stack[i]) == LVAL_ERR) { result = vm.stack[i]; }
+                }
+                lval* func = vm.stack[from];
+                if (!result && lval_type(func) != LVAL_FUNC) {
+                    result = lval_err("S-Expression starts with incorrect type. Got %s, Expected %s.",
+                        ltype_name(lval_type(func)), ltype_name(LVAL_FUNC));
+                }
+                if (result) {
+                    vm.sp = from;
+                    vm_push(result);
+                    break;
+                }
+
+                // if and eval with valid arguments run the chosen list in this environment
+                lval* next = NULL;
+                lval** a = &vm.stack[from + 1];
+                if (func->builtin == builtin_if && n == 4 && lval_type(a[0]) == LVAL_NUM
+                        && lval_type(a[1]) == LVAL_QEXPR && lval_type(a[2]) == LVAL_QEXPR) {
+                    next = lval_long(a[0]) ? a[1] : a[2];
+                } else if (func->builtin == builtin_eval && n == 2 && lval_type(a[0]) == LVAL_QEXPR) {
+                    next = a[0];
+                }
+                if (next) {
+                    vm.sp = from;
+                    if (tail) { vm_replace(f, f->env, next); } else { vm_enter(f->env, next); }
+                    break;
+                }
+
+                lenv* env = f->env;
+
+                // select, case and let likewise, once they have chosen
+                lpick pick = func->builtin ? builtin_pick(func->builtin) : NULL;
+                if (pick) {
+                    lval* args = vm_args(from + 1);
+                    vm.sp = from;
+                    vm_push(args);
+                    result = pick(&env, args, &next);
+                    f = &vm.frames[vm.fp - 1]; // evaluating a condition may have moved the frames
+                    if (result) {
+                        vm.stack[vm.sp - 1] = result;
+                        break;
+                    }
+                    vm.sp--;
+                    if (tail) { vm_replace(f, env, next); } else { vm_enter(env, next); }
+                    break;
+                }
+
+                // the common case of a lambda given all its arguments needs no argument list
+                lenv* frame = func->builtin ? NULL : vm_bind(func, from + 1);
+                if (frame) {
+                    vm.sp = from;
+                    if (tail) { vm_replace(f, frame, func->body); } else { vm_enter(frame, func->body); }
+                    break;
+                }
+
+                // the argument list takes the place of the call on the stack while it runs
+                lval* args = vm_args(from + 1);
+                vm.sp = from;
+                vm_push(args);
+                if (func->builtin) {
+                    result = func->builtin(env, args);
+                    vm.stack[vm.sp - 1] = result;
+                    break;
+                }
+                result = lval_bind(env, func, args, &frame);
+                if (result) {
+                    vm.stack[vm.sp - 1] = result;
+                } else {
+                    vm.sp--;
+                    if (tail) { vm_replace(f, frame, func->body); } else { vm_enter(frame, func->body); }
+                }
+                break;
+            }
+
+            case OP_RETURN: {
+                lval* result = vm.stack[vm.sp - 1];
+                vm.sp = f->base;
+                vm.fp--;
+                if (vm.fp == floor) { return result; }
+                vm_push(result);
+                break;
+            }
+        }
+    }
+}
+
+// build with -DNO_VM to evaluate everything with the tree walker
+lval* lval_eval_sexpr(lenv* env, lval* v) {
+#ifdef NO_VM
+    return lval_walk_sexpr(env, v);
+#else
+    return vm_run(env, v);
+#endif
 }
 
 /* lval_eval is passed the root or first lval from the reader, the
@@ -1002,13 +4651,9 @@ lval* lval_eval_sexpr(lenv* env, lval* v) {
  * guarenteed to be an sexpr unless its an expr or invalid.
 */
 lval* lval_eval(lenv* env, lval* value) {
-    if (value->type == LVAL_SYM) {
-        lval* x = lenv_get(env, value);
-        lval_del(value);
-        return x;
-    }
+    if (lval_type(value) == LVAL_SYM) { return lenv_get(env, value); }
     // evaluate S-expressions
-    if (value->type == LVAL_SEXPR) { return lval_eval_sexpr(env, value); }
+    if (lval_type(value) == LVAL_SEXPR) { return lval_eval_sexpr(env, value); }
     return value;
 }
 
@@ -1016,24 +4661,28 @@ lval* builtin_load(lenv* env, lval* args) {
     LASSERT_NUM_ARGS("load", args, 1);
     LASSERT_TYPE("load", args, 0, LVAL_STR);
 
+    char* name = args->cell[0]->str;
+    size_t len;
+    char* src = src_map(name, &len);
+    if (!src) { return lval_err("Could not load Library %s: %s", name, strerror(errno)); }
+    // a file written by save-image is bound as it is, there is nothing to evaluate
+    if (image_is(src, len)) {
+        if (par_worker) {
+            src_unmap(src, len);
+            return lval_err("Could not load Image %s: images cannot be loaded in a parallel task", name);
+        }
+        lval* x = image_restore(name, src, len);
+        src_unmap(src, len);
+        return x;
+    }
+
+#ifdef MPC_READER
+    src_unmap(src, len);
     mpc_result_t result;
     // Parse File given by string name args->cell[0]->str
-    if (mpc_parse_contents(args->cell[0]->str, Program, &result)) {
-        lval* expr = lval_read(result.output); // read contents
-        mpc_ast_delete(result.output);
-        // Evaluate each Expression (line by line)
-        while (expr->count) {
-            lval* x = lval_eval(env, lval_pop(expr, 0));
-            /* If Evaluation leads to error print it */
-            if (x->type == LVAL_ERR) { lval_println(x); }
-            lval_del(x);
-        }
-        lval_del(expr);
-        lval_del(args);
-        // Return empty list
-        return lval_sexpr();
-
-    } else {
+    PAR_LOCK(mpc_lock);
+    if (!mpc_parse_contents(args->cell[0]->str, Program, &result)) {
+        PAR_UNLOCK(mpc_lock);
         /* Get Parse Error as String */
         char* err_msg = mpc_err_string(result.error);
         mpc_err_delete(result.error);
@@ -1041,9 +4690,47 @@ lval* builtin_load(lenv* env, lval* args) {
         /* Create new error message using it */
         lval* err = lval_err("Could not load Library %s", err_msg);
         free(err_msg);
-        lval_del(args);
         return err;
     }
+    lval* expr = lval_read(result.output); // read contents
+    mpc_ast_delete(result.output);
+    PAR_UNLOCK(mpc_lock);
+
+    // the forms not yet evaluated must survive collections
+    int height = gc_save();
+    gc_root_val(&expr);
+    // Evaluate each Expression (line by line)
+    while (expr->count) {
+        lval* x = lval_eval(env, lval_pop(expr, 0));
+        /* If Evaluation leads to error print it */
+        if (lval_type(x) == LVAL_ERR) { lval_println(x); }
+    }
+    gc_restore(height);
+    // Return empty list
+    return lval_sexpr();
+#else
+    /* read, evaluate and drop one form at a time, so memory is bounded by the
+     * largest form rather than by the file. the forms before a syntax error
+     * have already been evaluated when it is reported */
+    lreader r;
+    reader_init(&r, name, src, len);
+    size_t released = 0;
+    lval* x;
+    while ((x = reader_next(&r))) {
+        x = lval_eval(env, x);
+        /* If Evaluation leads to error print it */
+        if (lval_type(x) == LVAL_ERR) { lval_println(x); }
+        // hand back the pages behind us every so often
+        if ((size_t) (r.pos - src) - released > LOAD_RELEASE_BYTES) {
+            released = r.pos - src;
+            src_release(src, released);
+        }
+    }
+    reader_done(&r);
+    src_unmap(src, len);
+    if (r.err) { return lval_err("Could not load Library %s", r.err->err); }
+    return lval_sexpr();
+#endif
 }
 
 /* so far we define the grammar, create the parsers, parse the input, build an ast. */
@@ -1060,8 +4747,8 @@ int main(int argc, char** argv) {
 
     mpca_lang(MPCA_LANG_DEFAULT,
     "                                                                                               \
-        number  : /-?[0-9]+/ ;                                                                      \
-        symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;                                                \
+        number  : /-?[0-9]+(\\.[0-9]+)?/ ;                                                         \
+        symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&?]+/ ;                                               \
         string  : /\"(\\\\.|[^\"])*\"/ ;                                                            \
         comment : /;[^\\r\\n]*/ ;                                                                   \
         sexpr   : '(' <expr>* ')' ;                                                                 \
@@ -1070,7 +4757,10 @@ int main(int argc, char** argv) {
         program : /^/ <expr>* /$/ ;                                                                 \
     ", Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Program);
 
+    sym_amp = sym_intern("&");
+
     lenv* env = lenv_new();
+    gc.global = env;
     lenv_add_builtins(env);
 
     if (argc == 1) {
@@ -1082,16 +4772,21 @@ int main(int argc, char** argv) {
             char* input = readline("λ> ");
             add_history(input);
 
+#ifdef MPC_READER
             mpc_result_t parse_result;
             if (mpc_parse("<stdin>", input, Program, &parse_result)) {
                 lval* eval_result = lval_eval(env, lval_read(parse_result.output));
                 lval_println(eval_result);
-                lval_del(eval_result);
                 mpc_ast_delete(parse_result.output);
             } else {
                 mpc_err_print(parse_result.error);
                 mpc_err_delete(parse_result.error);
             }
+#else
+            lval* expr = lval_read_src("<stdin>", input, strlen(input));
+            // a parse error is printed as it is, otherwise the line is one expression
+            lval_println(lval_type(expr) == LVAL_ERR ? expr : lval_eval(env, expr));
+#endif
             free(input);
         }
     }
@@ -1101,16 +4796,18 @@ int main(int argc, char** argv) {
         for (int i = 1; i < argc; i++) {
             /* Argument list with a single argument, the filename */
             lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
-            /* Pass to builtin load and get the result */
+            /* Pass to builtin load and get the result, the file name must outlive collections */
+            int height = gc_save();
+            gc_root_val(&args);
             lval* x = builtin_load(env, args);
+            gc_restore(height);
             /* If the result is an error be sure to print it */
-            if (x->type == LVAL_ERR) { lval_println(x); }
-            lval_del(x);
+            if (lval_type(x) == LVAL_ERR) { lval_println(x); }
         }
     }
 
-    /* delete environment */
-    lenv_del(env);
+    /* delete environment and everything else on the heap */
+    gc_free_all();
     /* delete parsers */
     mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Program);
     return 0;
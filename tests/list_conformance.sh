@@ -0,0 +1,71 @@
+#! /bin/bash
+# Checks the list builtins against the prelude functions they replaced, kept in
+# tests/prelude_lists.lspy. Every case is run once with the builtin and once
+# with the old p- function, and the two must print the same value or error.
+#
+# usage: tests/list_conformance.sh [interpreter], the default is ./hyperlambda
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+hl=${1:-$root/hyperlambda}
+
+lists=('{}' '{1 2 3}' '{1 {2} "s"}' '{a b}' '{(+ 1 2) 4}' '{{1 2} {3 4}}'
+    '{1 2.5 100000000000000000000}' '5' '"str"' '+')
+counts=('0' '1' '2' '3' '4' '-1' '"x"' '{1}')
+unary=('(\ {x} {* x 2})' '(\ {x} {> x 1})' 'head' 'list' '(\ {x} {error "boom"})' '5')
+binary=('+' '-' 'join' '(\ {p q} {list p q})' '(\ {p q} {error "boom"})' '5')
+inits=('0' '{}')
+elems=('1' '1.0' '{2}' '"s"' '3')
+
+# one case per line, @ stands for the name prefix, nothing for the builtin and p- for the prelude
+cases() {
+    for l in "${lists[@]}"; do
+        for f in len reverse last; do echo "(@$f $l)"; done
+        for n in "${counts[@]}"; do
+            for f in nth take drop; do echo "(@$f $n $l)"; done
+        done
+        for g in "${unary[@]}"; do
+            for f in map filter; do echo "(@$f $g $l)"; done
+        done
+        for g in "${binary[@]}"; do
+            for z in "${inits[@]}"; do
+                for f in foldl foldr; do echo "(@$f $g $z $l)"; done
+            done
+        done
+        for x in "${elems[@]}"; do echo "(@elem $x $l)"; done
+        for m in "${lists[@]}"; do echo "(@zip $l $m)"; done
+    done
+    # too many arguments, and too few then the rest
+    echo '(@len {1} {2})'
+    echo '(@zip {1} {2} {3})'
+    echo '((@map head) {{1} {2}})'
+    echo '((@foldl +) 0 {1 2 3})'
+    echo '(((@foldr -) 0) {1 2 3})'
+    echo '((@nth 1) {4 5 6})'
+}
+
+prog=$(mktemp)
+out=$(mktemp)
+trap 'rm -f "$prog" "$out"' EXIT
+
+cases | while IFS= read -r c; do
+    echo "(print ${c//@/})"
+    echo "(print ${c//@/p-})"
+done > "$prog"
+
+"$hl" "$root/prelude.lspy" "$root/tests/prelude_lists.lspy" "$prog" > "$out" 2>&1
+total=$(cases | wc -l)
+if [ "$(wc -l < "$out")" -ne $((2 * total)) ]; then
+    echo "expected $((2 * total)) lines of output, got $(wc -l < "$out")"
+    tail -5 "$out"
+    exit 1
+fi
+
+# pair every case with what the builtin and the prelude printed for it
+failed=$(cases | paste -d '\n' - <(sed -n 'p;n' "$out") <(sed -n 'n;p' "$out") |
+    awk 'NR % 3 == 1 { c = $0 } NR % 3 == 2 { b = $0 }
+        NR % 3 == 0 && b != $0 { print c; print "  builtin: " b; print "  prelude: " $0; n++ }
+        END { exit n > 0 }')
+status=$?
+echo -n "$failed${failed:+$'\n'}"
+echo "$total cases, $([ $status -eq 0 ] && echo "all match" || echo "some differ")"
+exit $status